@@ -0,0 +1,110 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef AckProgram_h
+#define AckProgram_h
+#include "DCC.h"
+
+/* Compile time assembler for the ack manager programs.
+ *
+ * A program is written as a constexpr source array in the same notation as
+ * always, for example
+ *
+ *    constexpr ackOp FLASH MY_PROG_SRC[] = { BASELINE, V0, WACK, ITSKIP, ... SKIPTARGET, ... FAIL };
+ *    ACK_PROGRAM(MY_PROG);
+ *
+ * ACK_PROGRAM checks the source and defines MY_PROG as the assembled flash
+ * program. The assembler inserts the offset to the matching SKIPTARGET
+ * after every ITSKIP so the ack manager can jump without scanning.
+ *
+ * Only C++11 constexpr is used because that is what the AVR toolchain gives us,
+ * hence everything is a single return statement and recursion instead of loops.
+ */
+
+// Number of inline operands that follow an opcode
+constexpr byte ackOperands(ackOp op) {
+  return (op==SETBIT || op==SETCV || op==SETBYTE) ? 1 : 0;
+}
+
+// Source index of the opcode after the one at i
+constexpr size_t ackNext(const ackOp * src, size_t i) {
+  return i + 1 + ackOperands(src[i]);
+}
+
+// Assembled size of the source opcodes before index n (n must be on an opcode)
+constexpr size_t ackAssembledSize(const ackOp * src, size_t n, size_t i=0) {
+  return i>=n ? 0
+       : 1 + ackOperands(src[i]) + (src[i]==ITSKIP ? 1 : 0) + ackAssembledSize(src, n, ackNext(src,i));
+}
+
+// Source index of the first SKIPTARGET at or after opcode i, or n if none
+constexpr size_t ackFindTarget(const ackOp * src, size_t n, size_t i) {
+  return i>=n ? n : src[i]==SKIPTARGET ? i : ackFindTarget(src, n, ackNext(src,i));
+}
+
+constexpr size_t ackSkipOffset(const ackOp * src, size_t n, size_t i) {
+  return ackAssembledSize(src, ackFindTarget(src, n, ackNext(src,i))) - ackAssembledSize(src, i);
+}
+
+// Assembled byte at output position o, walking source opcode i which assembles at position out
+constexpr ackOp ackAssemble(const ackOp * src, size_t n, size_t o, size_t i=0, size_t out=0) {
+  return out==o ? src[i]
+       : (out+1==o && src[i]==ITSKIP) ? (ackOp)ackSkipOffset(src, n, i)
+       : (out+1==o) ? src[i+1]
+       : ackAssemble(src, n, o, ackNext(src,i), out + 1 + ackOperands(src[i]) + (src[i]==ITSKIP ? 1 : 0));
+}
+
+// Static checks on a source program
+
+constexpr bool ackOperandsComplete(const ackOp * src, size_t n, size_t i=0) {
+  return i>=n ? i==n : ackOperandsComplete(src, n, ackNext(src,i));
+}
+
+// every ITSKIP reaches a SKIPTARGET within 255 bytes, and every SKIPTARGET has an ITSKIP before it
+constexpr bool ackSkipsBalanced(const ackOp * src, size_t n, size_t i=0, bool skipOpen=false) {
+  return i>=n ? !skipOpen
+       : src[i]==ITSKIP ? (ackFindTarget(src, n, ackNext(src,i))<n && ackSkipOffset(src, n, i)<=255
+                           && ackSkipsBalanced(src, n, ackNext(src,i), true))
+       : src[i]==SKIPTARGET ? (skipOpen && ackSkipsBalanced(src, n, ackNext(src,i), false))
+       : ackSkipsBalanced(src, n, ackNext(src,i), skipOpen);
+}
+
+constexpr bool ackEndsWithFail(const ackOp * src, size_t n) {
+  return n>0 && src[n-1]==FAIL;
+}
+
+// Index pack for expanding the assembled bytes into the flash array initialiser
+template<size_t... I> struct AckIndices {};
+template<size_t N, size_t... I> struct AckMakeIndices : AckMakeIndices<N-1, N-1, I...> {};
+template<size_t... I> struct AckMakeIndices<0, I...> { typedef AckIndices<I...> type; };
+
+template<const ackOp * SRC, size_t N, typename INDICES> struct AckProgram;
+template<const ackOp * SRC, size_t N, size_t... I> struct AckProgram<SRC, N, AckIndices<I...> > {
+  static const ackOp code[sizeof...(I)];
+};
+template<const ackOp * SRC, size_t N, size_t... I>
+const ackOp AckProgram<SRC, N, AckIndices<I...> >::code[sizeof...(I)] FLASH = { ackAssemble(SRC, N, I)... };
+
+#define ACK_PROGRAM(name) \
+  static_assert(ackOperandsComplete(name##_SRC, sizeof(name##_SRC)), #name ": opcode missing its operand"); \
+  static_assert(ackSkipsBalanced(name##_SRC, sizeof(name##_SRC)), #name ": ITSKIP without SKIPTARGET, SKIPTARGET without ITSKIP or skip too far"); \
+  static_assert(ackEndsWithFail(name##_SRC, sizeof(name##_SRC)), #name ": program must end with FAIL"); \
+  constexpr const ackOp * name = AckProgram<name##_SRC, sizeof(name##_SRC), \
+      AckMakeIndices<ackAssembledSize(name##_SRC, sizeof(name##_SRC))>::type>::code
+
+#endif
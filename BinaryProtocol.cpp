@@ -0,0 +1,104 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "BinaryProtocol.h"
+#include "DCCEXParser.h"
+#include "DIAG.h"
+
+// The reply is static so CurrentMeters subscriptions see the same stream each time
+BinaryProtocol::ReplyStream BinaryProtocol::reply;
+int BinaryProtocol::asyncStart;
+
+size_t BinaryProtocol::ReplyStream::write(uint8_t b) {
+  crc=crc8(crc, b);
+  return out->write(b);
+}
+
+byte BinaryProtocol::crc8(byte crc, byte b) {
+  crc^=b;
+  for (byte i=0; i<8; i++) crc= (crc & 0x80) ? (crc<<1) ^ 0x07 : crc<<1;
+  return crc;
+}
+
+void BinaryProtocol::parse(byte * buffer, int length, RingStream * stream) {
+  COMMAND_PARAM p[DCCEXParser::MAX_COMMAND_PARAMS];
+  int pos=0;
+  while (pos<length) {
+    int start=stream->written();
+    byte frameLength= pos+1<length ? buffer[pos+1] : 0;
+    if (buffer[pos]!=SENTINEL || frameLength==0 || (frameLength & 1)==0
+        || frameLength/2 > DCCEXParser::MAX_COMMAND_PARAMS || pos+frameLength+3 > length) {
+      if (Diag::CMD) DIAG(F("Binary frame error at %d"), pos);
+      badFrame(stream);
+      return;
+    }
+    byte * frame=buffer+pos+1;  // length, opcode, params, crc
+    byte crc=0;
+    for (byte i=0; i<=frameLength; i++) crc=crc8(crc, frame[i]);
+    if (crc!=frame[frameLength+1]) {
+      if (Diag::CMD) DIAG(F("Binary frame crc error at %d"), pos);
+      badFrame(stream);
+      return;
+    }
+
+    byte opcode=frame[1];
+    byte params=frameLength/2;
+    for (byte i=0; i<DCCEXParser::MAX_COMMAND_PARAMS; i++) 
+      p[i]= i<params ? (int16_t)(frame[2+2*i] | (frame[3+2*i]<<8)) : 0;
+    if (Diag::CMD) DIAG(F("Binary %c params=%d"), opcode, params);
+
+    startReply(stream, opcode);
+    bool ok=DCCEXParser::execute(&reply, opcode, params, p, NULL, stream);
+    endReply(stream, start, ok ? OK : FAILED);
+    pos+=frameLength+3;
+  }
+}
+
+void BinaryProtocol::badFrame(RingStream * stream) {
+  int start=stream->written();
+  startReply(stream, 0);
+  endReply(stream, start, BAD_FRAME);
+}
+
+void BinaryProtocol::startReply(RingStream * stream, byte opcode) {
+  stream->write(SENTINEL);
+  stream->write((uint8_t)0);  // length placeholders
+  stream->write((uint8_t)0);
+  reply.out=stream;
+  reply.crc=0;
+  reply.write(opcode);
+}
+
+void BinaryProtocol::endReply(RingStream * stream, int start, STATUS status) {
+  reply.write(status);
+  stream->write(reply.crc);
+  int length=stream->written()-start-4;  // opcode to status
+  stream->patch(start+1, lowByte(length));
+  stream->patch(start+2, highByte(length));
+}
+
+// Called from loop() once the ring is marked for the client, never while parse() is using reply
+Print * BinaryProtocol::startAsyncReply(RingStream * stream) {
+  asyncStart=stream->written();
+  startReply(stream, ASYNC);
+  return &reply;
+}
+
+void BinaryProtocol::endAsyncReply(RingStream * stream) {
+  endReply(stream, asyncStart, OK);
+}
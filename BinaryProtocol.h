@@ -0,0 +1,72 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef BinaryProtocol_h
+#define BinaryProtocol_h
+#include <Arduino.h>
+#include "RingStream.h"
+
+/* Binary command frames for high rate clients, on the same WiFi and Ethernet
+ * connections as <...> and WiThrottle. CommandDistributor sends anything
+ * starting with SENTINEL here.
+ *
+ * Command frame:
+ *    SENTINEL length opcode p0lo p0hi p1lo p1hi ... crc
+ * length counts the opcode and parameter bytes, parameters are int16_t little endian.
+ * The opcode and parameters are the same as the <...> command, so <t 3 50 1> is
+ *    FE 07 74 03 00 32 00 01 00 crc
+ * crc is the CRC-8 (polynomial 0x07, starting at 0) of length, opcode and parameters.
+ * A buffer may hold several frames.
+ *
+ * Each frame gets a reply frame:
+ *    SENTINEL lengthlo lengthhi opcode text... status crc
+ * length counts opcode to status, crc covers the same bytes. The text is whatever
+ * the <...> command replies, if anything. status is OK, FAILED where <X> would 
+ * have been sent, or BAD_FRAME with opcode 0, after which the rest of the buffer
+ * is ignored. CV programming results arrive later in a reply frame of their own
+ * with opcode ASYNC and the <r...> text. Binary clients cannot subscribe to <c>
+ * meters, they poll with <c> instead.
+ */
+
+class BinaryProtocol {
+  public:
+    static const byte SENTINEL=0xFE;
+    enum STATUS : byte { OK=0, FAILED=1, BAD_FRAME=2 };
+    static void parse(byte * buffer, int length, RingStream * stream);
+    static byte crc8(byte crc, byte b);
+    static void badFrame(RingStream * stream);  // BAD_FRAME reply
+    // Frame around a reply that comes after the command has finished
+    static const byte ASYNC=0xFF;
+    static Print * startAsyncReply(RingStream * stream);
+    static void endAsyncReply(RingStream * stream);
+
+  private:
+    // Passes the reply text on to the ring while adding it to the crc
+    class ReplyStream : public Print {
+      public:
+        RingStream * out;
+        byte crc;
+        virtual size_t write(uint8_t b);
+        using Print::write;
+    };
+    static ReplyStream reply;
+    static int asyncStart;
+    static void startReply(RingStream * stream, byte opcode);
+    static void endReply(RingStream * stream, int start, STATUS status);
+};
+#endif
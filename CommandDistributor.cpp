@@ -19,13 +19,20 @@
 #include <Arduino.h>
 #include "CommandDistributor.h"
 #include "WiThrottle.h"
+#include "Profiler.h"
+#include "BinaryProtocol.h"
 
 DCCEXParser * CommandDistributor::parser=0; 
 
-void  CommandDistributor::parse(byte clientId,byte * buffer, RingStream * streamer) {
- if (buffer[0] == '<')  {
+void  CommandDistributor::parse(byte clientId,byte * buffer, int length, RingStream * streamer) {
+  PROFILE_COMMAND_START();
+  if (buffer[0] == BinaryProtocol::SENTINEL) BinaryProtocol::parse(buffer, length, streamer);
+  else if (buffer[0] == '<')  {
     if (!parser) parser = new DCCEXParser();
+    PROFILE_MICROS_START(parseStart);
     parser->parse(streamer, buffer, streamer); 
+    PROFILE_MICROS_END(parseStart, PROFILE_PARSE);
   }
   else WiThrottle::getThrottle(clientId)->parse(streamer, buffer);
+  PROFILE_COMMAND_END();
 }
@@ -24,7 +24,7 @@
 class CommandDistributor {
 
 public :
-  static void parse(byte clientId,byte* buffer, RingStream * streamer);
+  static void parse(byte clientId,byte* buffer, int length, RingStream * streamer);
 private:
    static DCCEXParser * parser;
 };
@@ -0,0 +1,106 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "CommandFramer.h"
+#include "BinaryProtocol.h"
+#include "DIAG.h"
+#include "StringFormatter.h"
+
+CommandFramer::CommandFramer() {
+  reset();
+}
+
+void CommandFramer::reset() {
+  state=IDLE;
+  length=0;
+  remaining=0;
+}
+
+byte * CommandFramer::frame() {
+  return buffer;
+}
+
+int CommandFramer::complete() {
+  int frameLength=length;
+  buffer[length]='\0';
+  state=IDLE;
+  length=0;
+  return frameLength;
+}
+
+int CommandFramer::add(byte ch) {
+  switch (state) {
+    case IDLE:
+      if (ch=='\r' || ch=='\n' || ch==' ') return 0;
+      if (ch=='<') state=TEXT;
+      else if (ch==BinaryProtocol::SENTINEL) {
+        state=BINARY;
+        remaining=-1;  // length byte next
+      }
+      else state=LINE;
+      buffer[length++]=ch;
+      return 0;
+
+    case TEXT:
+    case LINE:
+      if (state==LINE && (ch=='\r' || ch=='\n')) return complete();
+      if (length==MAX_FRAME) {
+        DIAG(F("Command too long, dropped"));
+        state= state==TEXT ? DISCARD_TEXT : DISCARD_LINE;
+        length=0;
+        return TOO_LONG;
+      }
+      buffer[length++]=ch;
+      if (state==TEXT && ch=='>') return complete();
+      return 0;
+
+    case BINARY:
+      buffer[length++]=ch;
+      if (remaining<0) {
+        remaining=ch+1;  // opcode, params and crc
+        if (length+remaining > MAX_FRAME) {
+          DIAG(F("Binary frame too long, dropped"));
+          state=DISCARD_BINARY;
+          length=0;
+          return TOO_LONG;
+        }
+        return 0;
+      }
+      if (--remaining==0) return complete();
+      return 0;
+
+    case DISCARD_TEXT:
+      if (ch=='>') state=IDLE;
+      return 0;
+
+    case DISCARD_LINE:
+      if (ch=='\r' || ch=='\n') state=IDLE;
+      return 0;
+
+    case DISCARD_BINARY:
+      if (--remaining==0) state=IDLE;
+      return 0;
+  }
+  return 0;
+}
+
+// WiThrottle has no error reply, so a dropped line only gets the DIAG
+void CommandFramer::reject(RingStream * stream) {
+  if (state==DISCARD_TEXT) StringFormatter::send(stream, F("<X>\n"));
+  else if (state==DISCARD_BINARY) BinaryProtocol::badFrame(stream);
+}
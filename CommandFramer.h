@@ -0,0 +1,61 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CommandFramer_h
+#define CommandFramer_h
+#include <Arduino.h>
+#include "DCCEXParser.h"
+#include "RingStream.h"
+
+// Collects the bytes arriving on one network connection into whole commands,
+// however they were split into packets:
+//    <...>             DCC-EX command, including the < and >
+//    line              WiThrottle command, up to but not including \r or \n
+//    binary frame      see BinaryProtocol.h
+// A command longer than MAX_FRAME, which is at least as long as the parser will
+// take, is dropped up to its end. add() returns TOO_LONG when that starts and
+// reject() then replies to it as the parser would have.
+
+class CommandFramer {
+  public:
+    static const int MAX_FRAME= COMMAND_BUFFER_SIZE+2 > 64 ? COMMAND_BUFFER_SIZE+2 : 64;  // +2 for < and >
+    CommandFramer();
+    static const int TOO_LONG=-1;
+    // Adds a byte, returns the length of the command completed by it, 0, or TOO_LONG
+    int add(byte ch);
+    byte * frame();   // the completed command, zero terminated
+    void reset();     // forget any partial command
+    void reject(RingStream * stream);  // <X> or BAD_FRAME for the command being dropped
+    
+  private:
+    enum FRAME_STATE : byte {
+      IDLE,            // between commands
+      TEXT,            // in <...>
+      LINE,            // in a WiThrottle line
+      BINARY,          // in a binary frame
+      DISCARD_TEXT,    // too long, dropping to >
+      DISCARD_LINE,    // too long, dropping to end of line
+      DISCARD_BINARY   // too long, dropping remaining bytes
+    };
+    FRAME_STATE state;
+    int length;
+    int remaining;     // binary frame bytes still to come
+    byte buffer[MAX_FRAME+1];
+    int complete();
+};
+#endif
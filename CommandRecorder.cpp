@@ -0,0 +1,166 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "CommandRecorder.h"
+#ifdef ENABLE_RECORDER
+#include "CommandDistributor.h"
+#include "CurrentMeters.h"
+#include "DCCEXParser.h"
+#include "Keywords.h"
+#include "Profiler.h"
+#include "RingStream.h"
+#include "StringFormatter.h"
+#include "DIAG.h"
+
+byte CommandRecorder::recordBuffer[RECORDER_SIZE];
+int CommandRecorder::used=0;
+bool CommandRecorder::recording=false;
+bool CommandRecorder::full=false;
+bool CommandRecorder::playing=false;
+bool CommandRecorder::playFast=false;
+int CommandRecorder::playPosition=0;
+unsigned long CommandRecorder::lastTime=0;
+unsigned long CommandRecorder::playStart=0;
+int CommandRecorder::playCount=0;
+RingStream * CommandRecorder::replyRing=NULL;
+
+void CommandRecorder::record(byte source, const byte * command, int length) {
+  if (!recording) return;
+  if (length>255 || used+HEADER+length+1 > RECORDER_SIZE) {
+    recording=false;
+    full=true;
+    DIAG(F("RECORD full after %d bytes"), used);
+    return;
+  }
+  unsigned long now=millis();
+  unsigned long gap=used ? now-lastTime : 0;
+  if (gap>0xFFFF) gap=0xFFFF;
+  lastTime=now;
+  recordBuffer[used++]=source;
+  recordBuffer[used++]=highByte(gap);
+  recordBuffer[used++]=lowByte(gap);
+  recordBuffer[used++]=length;
+  memcpy(recordBuffer+used, command, length);
+  used+=length;
+  recordBuffer[used++]='\0';  // so it can be parsed in place when played
+}
+
+bool CommandRecorder::command(Print * stream, int16_t action, int16_t option) {
+  switch (keyword(action)) {
+    case KEYWORD_ON:
+      start();
+      return true;
+    case KEYWORD_OFF:
+      recording=false;
+      if (playing) stopPlaying();
+      StringFormatter::send(stream, F("RECORD %d bytes%S\n"), used, full ? F(" FULL") : F(""));
+      return true;
+    case KEYWORD_DUMP:
+      dump(stream);
+      return true;
+    case KEYWORD_PLAY:
+      play(option==HASH_KEYWORD_FAST);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void CommandRecorder::start() {
+  if (playing) stopPlaying();
+  used=0;
+  full=false;
+  recording=true;
+}
+
+// 32 bytes to a line so a script can rebuild the binary log
+void CommandRecorder::dump(Print * stream) {
+  StringFormatter::send(stream, F("RECORD %d\n"), used);
+  for (int line=0; line<used; line+=32) {
+    StringFormatter::send(stream, F("RECORD "));
+    for (int i=line; i<used && i<line+32; i++) {
+      if (recordBuffer[i]<0x10) stream->write('0');
+      stream->print(recordBuffer[i], HEX);
+    }
+    StringFormatter::send(stream, F("\n"));
+  }
+}
+
+void CommandRecorder::play(bool fast) {
+  recording=false;  // or it would record itself
+  if (!replyRing) replyRing=new RingStream(REPLY_RING);
+  playing=true;
+  playFast=fast;
+  playPosition=0;
+  playCount=0;
+  playStart=millis();
+  lastTime=playStart;
+}
+
+// replyRing is only read while playing, so a <c n> played back must not
+// leave meters pushed into it for ever
+void CommandRecorder::stopPlaying() {
+  playing=false;
+  for (int position=0; position<used; position+=HEADER+recordBuffer[position+3]+1) {
+    byte source=recordBuffer[position];
+    if (source!=RECORD_SERIAL) CurrentMeters::unsubscribe(replyRing, 0x80 | source);
+  }
+}
+
+// Plays the next commands once their gap has passed, within the command budget
+void CommandRecorder::loop() {
+  if (!playing) return;
+  unsigned long startTime=micros();
+  while (micros()-startTime < COMMAND_BUDGET_MICROS) {
+    if (playPosition>=used) {
+      stopPlaying();
+      StringFormatter::send(&Serial, F("REPLAY %d commands %l mS\n"), playCount, millis()-playStart);
+      return;
+    }
+    byte * entry=recordBuffer+playPosition;
+    unsigned long gap=((unsigned long)entry[1]<<8) | entry[2];
+    if (!playFast) {
+      if (millis()-lastTime < gap) return;
+      lastTime+=gap;
+    }
+    replay(entry);
+    playPosition+=HEADER+entry[3]+1;
+    playCount++;
+  }
+}
+
+void CommandRecorder::replay(byte * entry) {
+  static DCCEXParser serialParser;
+  byte source=entry[0];
+  byte * command=entry+HEADER;
+  if (source==RECORD_SERIAL) {
+    PROFILE_COMMAND_START();
+    serialParser.parse(&Serial, command, NULL);
+    PROFILE_COMMAND_END();
+    return;
+  }
+  // Network clients are played as clients of their own so they
+  // don't get mixed up with any that are connected now.
+  replyRing->mark(0x80 | source);
+  CommandDistributor::parse(0x80 | source, command, entry[3], replyRing);
+  replyRing->commit();
+  while (replyRing->read()>=0) {
+    for (int count=replyRing->count(); count>0; count--) Serial.write(replyRing->read());
+  }
+}
+#endif
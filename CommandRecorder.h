@@ -0,0 +1,87 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CommandRecorder_h
+#define CommandRecorder_h
+#include <Arduino.h>
+#if __has_include ( "config.h")
+  #include "config.h"
+#endif
+
+// Records the commands arriving from every source, only built with
+// #define ENABLE_RECORDER in config.h, so a session can be played back
+// later as repeatable load.
+//    <D RECORD ON>          start a new recording
+//    <D RECORD OFF>         stop recording or playing
+//    <D RECORD DUMP>        print the recording as hex, RECORD lines
+//    <D RECORD PLAY [FAST]> play it back with the original gaps, or as fast 
+//                           as the command budget allows
+// Played back replies go to Serial with a REPLAY summary at the end.
+//
+// Each command is kept in RECORDER_SIZE bytes of RAM as
+//    source gapHi gapLo length command... 0
+// source is RECORD_SERIAL, RECORD_WIFI+link id or RECORD_ETHERNET+socket and
+// gap the mS since the previous command, up to 65535. Recording stops
+// when the buffer is full.
+
+#ifndef RECORDER_SIZE
+#define RECORDER_SIZE 1024
+#endif
+
+enum RECORD_SOURCE : byte {
+  RECORD_SERIAL=0x00,
+  RECORD_WIFI=0x10,
+  RECORD_ETHERNET=0x20
+};
+
+#ifdef ENABLE_RECORDER
+class RingStream;
+
+class CommandRecorder {
+  public:
+    static void record(byte source, const byte * command, int length);
+    static bool command(Print * stream, int16_t action, int16_t option);  // <D RECORD ...>
+    static void loop();
+
+  private:
+    static const byte HEADER=4;        // source, gap, length
+    static const int REPLY_RING=512;
+    static void start();
+    static void dump(Print * stream);
+    static void play(bool fast);
+    static void stopPlaying();
+    static void replay(byte * entry);
+    static byte recordBuffer[RECORDER_SIZE];
+    static int used;
+    static bool recording;
+    static bool full;
+    static bool playing;
+    static bool playFast;
+    static int playPosition;
+    static unsigned long lastTime;     // millis of the last command recorded or played
+    static unsigned long playStart;
+    static int playCount;
+    static RingStream * replyRing;
+};
+
+#define RECORD_COMMAND(source, command, length) CommandRecorder::record(source, command, length)
+#else
+#define RECORD_COMMAND(source, command, length) do {} while (0)
+#endif
+
+#endif
@@ -84,6 +84,13 @@ void setup()
   // Standard supported devices have pre-configured macros but custome hardware installations require
   //  detailed pin mappings and may also require modified subclasses of the MotorDriver to implement specialist logic.
   // STANDARD_MOTOR_SHIELD, POLOLU_MOTOR_SHIELD, FIREBOX_MK1, FIREBOX_MK1S are pre defined in MotorShields.h
+  // Any extra power districts (see config.h) must be added first.
+#ifdef DISTRICT_DRIVERS
+  {
+    MotorDriver * districtDrivers[] = { DISTRICT_DRIVERS };
+    for (MotorDriver * driver : districtDrivers) DCC::addDistrict(driver);
+  }
+#endif
   DCC::begin(MOTOR_SHIELD_TYPE);
 
   #if defined(RMFT_ACTIVE) 
@@ -114,6 +121,7 @@ void loop()
 
   // Responsibility 2: handle any incoming commands on USB connection
   serialParser.loop(Serial);
+  CurrentMeters::loop();  // push current meters to any subscribed clients
 
 // Responsibility 3: Optionally handle any incoming WiFi traffic
 #if WIFI_ON
@@ -131,6 +139,10 @@ void loop()
       LCN::loop();
   #endif
 
+#ifdef ENABLE_RECORDER
+  CommandRecorder::loop();  // plays back a recorded session
+#endif
+
   LCDDisplay::loop();  // ignored if LCD not in use 
   
   // Report any decrease in memory (will automatically trigger on first call)
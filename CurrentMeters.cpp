@@ -0,0 +1,90 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "CurrentMeters.h"
+#include "DCCWaveform.h"
+#include "StringFormatter.h"
+
+CurrentMeters::Subscriber CurrentMeters::subscribers[MAX_SUBSCRIBERS];
+
+bool CurrentMeters::subscribe(Print * stream, RingStream * ringStream, unsigned int interval) {
+  byte target= ringStream ? ringStream->peekTargetMark() : 0;
+  if (interval>0 && interval<MIN_INTERVAL) interval=MIN_INTERVAL;
+  Subscriber * slot=NULL;
+  for (byte i=0; i<MAX_SUBSCRIBERS; i++) {
+    Subscriber & s=subscribers[i];
+    if (s.stream==NULL) {
+      if (!slot) slot=&s;
+    }
+    else if (s.stream==stream && s.ringStream==ringStream && s.target==target) {
+      slot=&s;  // already subscribed, change the interval
+      break;
+    }
+  }
+  if (interval==0) {
+    if (slot) slot->stream=NULL;
+    return true;
+  }
+  if (!slot) return false;
+  slot->stream=stream;
+  slot->ringStream=ringStream;
+  slot->target=target;
+  slot->interval=interval;
+  slot->lastSent=millis();
+  return true;
+}
+
+void CurrentMeters::unsubscribe(RingStream * ringStream, byte target) {
+  for (byte i=0; i<MAX_SUBSCRIBERS; i++) {
+    Subscriber & s=subscribers[i];
+    if (s.stream && s.ringStream==ringStream && s.target==target) s.stream=NULL;
+  }
+}
+
+static void printTrack(Print * stream, const FSH * name, byte district, DCCWaveform & track) {
+  const CurrentStats & s=track.getStats(false);
+  const CurrentStats & l=track.getStats(true);
+  if (district) StringFormatter::send(stream, F("<c METER %d"), district);
+  else StringFormatter::send(stream, F("<c METER %S"), name);
+  StringFormatter::send(stream, F(" %d %d %d %d %d %d %d %d>\n"),
+                        s.minimum, s.maximum, s.average, s.rms, l.minimum, l.maximum, l.average, l.rms);
+}
+
+void CurrentMeters::print(Print * stream) {
+  StringFormatter::send(stream, F("<c CurrentMAIN %d C Milli 0 %d 1 %d>\n"), DCCWaveform::mainTrack.getCurrentmA(), 
+                        DCCWaveform::mainTrack.getMaxmA(), DCCWaveform::mainTrack.getTripmA());
+  printTrack(stream, F("MAIN"), 0, DCCWaveform::mainTrack);
+  printTrack(stream, F("PROG"), 0, DCCWaveform::progTrack);
+  for (byte d=1; d<=DCCWaveform::getDistrictCount(); d++) 
+    printTrack(stream, NULL, d, *DCCWaveform::getDistrict(d));
+}
+
+void CurrentMeters::loop() {
+  unsigned long now=millis();
+  for (byte i=0; i<MAX_SUBSCRIBERS; i++) {
+    Subscriber & s=subscribers[i];
+    if (s.stream==NULL || now - s.lastSent < s.interval) continue;
+    s.lastSent=now;
+    if (s.ringStream) {
+      s.ringStream->mark(s.target);
+      print(s.ringStream);
+      s.ringStream->commit();
+    }
+    else print(s.stream);
+  }
+}
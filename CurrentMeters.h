@@ -0,0 +1,49 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CurrentMeters_h
+#define CurrentMeters_h
+#include <Arduino.h>
+#include "RingStream.h"
+
+// Pushes the track current meters to clients that asked for them with <c interval>.
+// Each push is the usual <c CurrentMAIN ...> line followed by one line per track
+//    <c METER track min max avg rms min10 max10 avg10 rms10>
+// in mA over the last 1 and 10 seconds, where track is MAIN, PROG or a district number.
+
+class CurrentMeters {
+  public:
+    static bool subscribe(Print * stream, RingStream * ringStream, unsigned int interval); // interval 0 unsubscribes
+    static void unsubscribe(RingStream * ringStream, byte target);  // a network client has gone
+    static void print(Print * stream);
+    static void loop();
+
+  private:
+    static const byte MAX_SUBSCRIBERS=4;
+    static const unsigned int MIN_INTERVAL=250;  // mS
+
+    struct Subscriber {
+      Print * stream;           // NULL when unused
+      RingStream * ringStream;  // NULL for serial
+      byte target;              // client id in ringStream
+      unsigned int interval;
+      unsigned long lastSent;
+    };
+    static Subscriber subscribers[MAX_SUBSCRIBERS];
+};
+#endif
@@ -20,6 +20,7 @@
 #include "DIAG.h"
 #include "DCC.h"
 #include "DCCWaveform.h"
+#include "AckProgram.h"
 #include "EEStore.h"
 #include "GITHUB_SHA.h"
 #include "version.h"
@@ -59,6 +60,10 @@ void DCC::begin(const FSH * motorShieldName, MotorDriver * mainDriver, MotorDriv
   DCCWaveform::begin(mainDriver,progDriver); 
 }
 
+bool DCC::addDistrict(MotorDriver * driver) {
+  return DCCWaveform::addDistrict(driver);
+}
+
 void DCC::setJoinRelayPin(byte joinRelayPin) {
   joinRelay=joinRelayPin;
   if (joinRelay!=UNUSED_PIN) {
@@ -75,8 +80,13 @@ void DCC::setThrottle( uint16_t cab, uint8_t tSpeed, bool tDirection)  {
 }
 
 void DCC::setThrottle2( uint16_t cab, byte speedCode)  {
-
   uint8_t b[4];
+  uint8_t nB = speedPacket(b, cab, speedCode);
+  DCCWaveform::mainTrack.schedulePacket(b, nB, 0);
+}
+
+// Builds the speed packet (without checksum) and returns its length
+byte DCC::speedPacket(byte b[4], uint16_t cab, byte speedCode)  {
   uint8_t nB = 0;
   // DIAG(F("setSpeedInternal %d %x"),cab,speedCode);
   
@@ -111,8 +121,7 @@ void DCC::setThrottle2( uint16_t cab, byte speedCode)  {
     b[nB++] = speedCode; // for encoding see setThrottle
 
   }
-
-  DCCWaveform::mainTrack.schedulePacket(b, nB, 0);
+  return nB;
 }
 
 void DCC::setFunctionInternal(int cab, byte byte1, byte byte2) {
@@ -143,7 +152,7 @@ bool DCC::getThrottleDirection(int cab) {
 
 // Set function to value on or off
 void DCC::setFn( int cab, int16_t functionNumber, bool on) {
-  if (cab<=0 ) return;
+  if (cab<=0 || functionNumber<0) return;
   
   if (functionNumber>28) { 
     //non reminding advanced binary bit set 
@@ -185,7 +194,7 @@ void DCC::setFn( int cab, int16_t functionNumber, bool on) {
 // Returns new state or -1 if nothing was changed.
 int DCC::changeFn( int cab, int16_t functionNumber, bool pressed) {
   int funcstate = -1;
-  if (cab<=0 || functionNumber>28) return funcstate;
+  if (cab<=0 || functionNumber<0 || functionNumber>28) return funcstate;
   int reg = lookupSpeedTable(cab);
   if (reg<0) return funcstate;  
 
@@ -214,7 +223,7 @@ int DCC::changeFn( int cab, int16_t functionNumber, bool pressed) {
 }
 
 int DCC::getFn( int cab, int16_t functionNumber) {
-  if (cab<=0 || functionNumber>28) return -1;  // unknown
+  if (cab<=0 || functionNumber<0 || functionNumber>28) return -1;  // unknown
   int reg = lookupSpeedTable(cab);
   if (reg<0) return -1;  
 
@@ -299,22 +308,26 @@ FSH* DCC::getMotorShieldName() {
   return shieldName;
 }
   
-const ackOp FLASH WRITE_BIT0_PROG[] = {
+constexpr ackOp FLASH WRITE_BIT0_PROG_SRC[] = {
      BASELINE,
      W0,WACK,
      V0, WACK,  // validate bit is 0 
      ITC1,      // if acked, callback(1)
      FAIL  // callback (-1)
 };
-const ackOp FLASH WRITE_BIT1_PROG[] = {
+ACK_PROGRAM(WRITE_BIT0_PROG);
+
+constexpr ackOp FLASH WRITE_BIT1_PROG_SRC[] = {
      BASELINE,
      W1,WACK,
      V1, WACK,  // validate bit is 1 
      ITC1,      // if acked, callback(1)
      FAIL  // callback (-1)
 };
+ACK_PROGRAM(WRITE_BIT1_PROG);
 
-const ackOp FLASH VERIFY_BIT0_PROG[] = {
+
+constexpr ackOp FLASH VERIFY_BIT0_PROG_SRC[] = {
      BASELINE,
      V0, WACK,  // validate bit is 0 
      ITC0,      // if acked, callback(0)
@@ -322,7 +335,9 @@ const ackOp FLASH VERIFY_BIT0_PROG[] = {
      ITC1,       
      FAIL  // callback (-1)
 };
-const ackOp FLASH VERIFY_BIT1_PROG[] = {
+ACK_PROGRAM(VERIFY_BIT0_PROG);
+
+constexpr ackOp FLASH VERIFY_BIT1_PROG_SRC[] = {
      BASELINE,
      V1, WACK,  // validate bit is 1 
      ITC1,      // if acked, callback(1)
@@ -330,8 +345,10 @@ const ackOp FLASH VERIFY_BIT1_PROG[] = {
      ITC0,
      FAIL  // callback (-1)
 };
+ACK_PROGRAM(VERIFY_BIT1_PROG);
 
-const ackOp FLASH READ_BIT_PROG[] = {
+
+constexpr ackOp FLASH READ_BIT_PROG_SRC[] = {
      BASELINE,
      V1, WACK,  // validate bit is 1 
      ITC1,      // if acked, callback(1)
@@ -339,16 +356,20 @@ const ackOp FLASH READ_BIT_PROG[] = {
      ITC0,      // if acked callback 0
      FAIL       // bit not readable 
      };
+ACK_PROGRAM(READ_BIT_PROG);
+
      
-const ackOp FLASH WRITE_BYTE_PROG[] = {
+constexpr ackOp FLASH WRITE_BYTE_PROG_SRC[] = {
       BASELINE,
       WB,WACK,ITC1,    // Write and callback(1) if ACK 
       // handle decoders that dont ack a write 
       VB,WACK,ITC1,    // validate byte and callback(1) if correct 
       FAIL        // callback (-1)
       };
+ACK_PROGRAM(WRITE_BYTE_PROG);
+
       
-const ackOp FLASH VERIFY_BYTE_PROG[] = {
+constexpr ackOp FLASH VERIFY_BYTE_PROG_SRC[] = {
       BASELINE,
       VB,WACK,     // validate byte 
       ITCB,       // if ok callback value
@@ -371,9 +392,11 @@ const ackOp FLASH VERIFY_BYTE_PROG[] = {
       V0, WACK, MERGE,
       VB, WACK, ITCB,  // verify merged byte and return it if acked ok 
       FAIL };
+ACK_PROGRAM(VERIFY_BYTE_PROG);
+
       
       
-const ackOp FLASH READ_CV_PROG[] = {
+constexpr ackOp FLASH READ_CV_PROG_SRC[] = {
       BASELINE,
       STARTMERGE,    //clear bit and byte values ready for merge pass
       // each bit is validated against 0 and the result inverted in MERGE
@@ -394,9 +417,10 @@ const ackOp FLASH READ_CV_PROG[] = {
       V0, WACK, MERGE,
       VB, WACK, ITCB,  // verify merged byte and return it if acked ok 
       FAIL };          // verification failed
+ACK_PROGRAM(READ_CV_PROG);
 
 
-const ackOp FLASH LOCO_ID_PROG[] = {
+constexpr ackOp FLASH LOCO_ID_PROG_SRC[] = {
       BASELINE,
       SETCV, (ackOp)19,     // CV 19 is consist setting
       SETBYTE, (ackOp)0,    
@@ -460,9 +484,11 @@ const ackOp FLASH LOCO_ID_PROG[] = {
       V0, WACK, MERGE,
       VB, WACK, ITCB,  // verify merged byte and callback
       FAIL
-      };    
+      };
+ACK_PROGRAM(LOCO_ID_PROG);
+    
 
-const ackOp FLASH SHORT_LOCO_ID_PROG[] = {
+constexpr ackOp FLASH SHORT_LOCO_ID_PROG_SRC[] = {
       BASELINE,
       SETCV,(ackOp)19,
       SETBYTE, (ackOp)0,
@@ -477,9 +503,11 @@ const ackOp FLASH SHORT_LOCO_ID_PROG[] = {
       WB,WACK,    // some decoders don't ACK writes
       VB,WACK,ITCB,
       FAIL
-};    
+};
+ACK_PROGRAM(SHORT_LOCO_ID_PROG);
+    
 
-const ackOp FLASH LONG_LOCO_ID_PROG[] = {
+constexpr ackOp FLASH LONG_LOCO_ID_PROG_SRC[] = {
       BASELINE,
       // Clear consist CV 19
       SETCV,(ackOp)19,
@@ -501,7 +529,9 @@ const ackOp FLASH LONG_LOCO_ID_PROG[] = {
       WB,WACK,
       VB,WACK,ITC1,   // callback(1) means Ok
       FAIL
-};    
+};
+ACK_PROGRAM(LONG_LOCO_ID_PROG);
+    
 
 void  DCC::writeCVByte(int16_t cv, byte byteValue, ACK_CALLBACK callback)  {
   ackManagerSetup(cv, byteValue,  WRITE_BYTE_PROG, callback);
@@ -551,10 +581,12 @@ void DCC::forgetLoco(int cab) {  // removes any speed reminders for this loco
   int reg=lookupSpeedTable(cab);
   if (reg>=0) speedTable[reg].loco=0;
   setThrottle2(cab,1); // ESTOP if this loco still on track
+  publishReminders();
 }
 void DCC::forgetAllLocos() {  // removes all speed reminders
   setThrottle2(0,1); // ESTOP all locos still on track      
   for (int i=0;i<MAX_LOCOS;i++) speedTable[i].loco=0;
+  publishReminders();
 }
 
 byte DCC::loopStatus=0;  
@@ -562,9 +594,28 @@ byte DCC::loopStatus=0;
 void DCC::loop()  {
   DCCWaveform::loop(ackManagerProg!=NULL); // power overload checks
   ackManagerLoop();    // maintain prog track ack manager
+  if (remindersChanged) publishReminders();
   issueReminders();
 }
 
+// Hand the waveform a fresh set of speed packets that it can remind with by itself
+// whenever it has nothing else to send. This keeps decoders fed even if loop()
+// is held up for a while. A speed change or a forgotten loco publishes straight
+// away, so the old speed is never reminded once the new packet has gone; anything
+// else that changes the packets leaves it to the next loop().
+void DCC::publishReminders() {
+  remindersChanged=false;
+  byte count=0;
+  for (int reg=0;reg<MAX_LOCOS;reg++) {
+    if (speedTable[reg].loco<=0) continue;
+    byte * packet=reminderPackets[reminderBuffer][count++];
+    memset(packet,0,4);
+    speedPacket(packet, speedTable[reg].loco, speedTable[reg].speedCode);
+  }
+  DCCWaveform::mainTrack.setReminders(reminderPackets[reminderBuffer], count);
+  reminderBuffer^=1;
+}
+
 void DCC::issueReminders() {
   // if the main track transmitter still has a pending packet, skip this time around.
   if ( DCCWaveform::mainTrack.packetPending) return;
@@ -637,6 +688,13 @@ byte DCC::cv2(int cv)  {
   return lowByte(cv);
 }
 
+bool DCC::isRegistered(int cab) {
+  if (cab<=0) return false;
+  for (int reg = 0; reg < MAX_LOCOS; reg++)
+    if (speedTable[reg].loco == cab) return true;
+  return false;
+}
+
 int DCC::lookupSpeedTable(int locoId) {
   // determine speed reg for this loco
   int firstEmpty = MAX_LOCOS;
@@ -655,6 +713,7 @@ int DCC::lookupSpeedTable(int locoId) {
         speedTable[reg].speedCode=128;  // default direction forward
         speedTable[reg].groupFlags=0;
         speedTable[reg].functions=0;
+        remindersChanged=true;
   }
   return reg;
 }
@@ -666,16 +725,26 @@ void  DCC::updateLocoReminder(int loco, byte speedCode) {
      for (int reg = 0; reg < MAX_LOCOS; reg++) {
        speedTable[reg].speedCode = (speedTable[reg].speedCode & 0x80) |  (speedCode & 0x7f);
      }
+     publishReminders();
      return; 
   }
   
   // determine speed reg for this loco
   int reg=lookupSpeedTable(loco);       
   if (reg>=0) speedTable[reg].speedCode = speedCode;
+  publishReminders();
 }
 
 DCC::LOCO DCC::speedTable[MAX_LOCOS];
 int DCC::nextLoco = 0;
+byte DCC::reminderPackets[2][MAX_LOCOS][4];
+byte DCC::reminderBuffer=0;
+bool DCC::remindersChanged=false;
+
+const byte RESET_MIN=8;  // tuning of reset counter before sending message
+const byte RESET_FAST=4; // resets before a validate packet once the decoder is known to be quick
+const byte ACK_LEARN_MIN=4;      // ACKs to observe before trusting the learned latency
+const byte ACK_LATENCY_MARGIN=2; // extra validate packets sent beyond the slowest ACK seen
 
 //ACK MANAGER
 ackOp  const *  DCC::ackManagerProg;
@@ -686,6 +755,14 @@ int    DCC::ackManagerCv;
 byte   DCC::ackManagerBitNum;
 bool   DCC::ackReceived;
 bool   DCC::ackManagerRejoin;
+unsigned long DCC::ackManagerStart;
+ackOp  const *  DCC::ackManagerProgStart;
+byte   DCC::ackManagerByteStart;
+byte   DCC::verifyRepeats=DCC::PROG_REPEATS;
+byte   DCC::verifyResets=RESET_MIN;
+byte   DCC::ackLatencyMax=0;
+byte   DCC::ackLatencyCount=0;
+bool   DCC::ackManagerVerifying;
 
 CALLBACK_STATE DCC::callbackState=READY;
 
@@ -712,8 +789,16 @@ void  DCC::ackManagerSetup(int cv, byte byteValueOrBitnum, ackOp const program[]
         DCCWaveform::progTrack.sentResetsSincePacket = 0;      
     }
 
+   if (DCCWaveform::progTrack.autoPowerOff || ackManagerRejoin) {
+        // decoder has just been powered up, it could be a different one
+        resetAckLatency();
+   }
+
   ackManagerCv = cv;
+  ackManagerStart = millis();
   ackManagerProg = program;
+  ackManagerProgStart = program;
+  ackManagerByteStart = byteValueOrBitnum;
   ackManagerByte = byteValueOrBitnum;
   ackManagerBitNum=byteValueOrBitnum;
   ackManagerCallback = callback;
@@ -724,7 +809,35 @@ void  DCC::ackManagerSetup(int wordval, ackOp const program[], ACK_CALLBACK call
   ackManagerSetup(0, 0, program, callback);
   }
 
-const byte RESET_MIN=8;  // tuning of reset counter before sending message
+// The decoder response is measured in validate packets sent before its ACK was seen.
+// Once a few ACKs have come back quickly, validate packets are sent with fewer 
+// resets and repeats. A NAK then still means a genuine zero/no-match because the
+// decoder had longer than it has ever needed to respond.
+void DCC::learnAckLatency() {
+  byte sent=verifyRepeats + 1 - DCCWaveform::progTrack.getAckUnsentRepeats();
+  if (sent>ackLatencyMax) ackLatencyMax=sent;
+  if (ackLatencyCount<ACK_LEARN_MIN) {
+    ackLatencyCount++;
+    return;
+  }
+  byte repeats=ackLatencyMax + ACK_LATENCY_MARGIN;
+  if (repeats>=PROG_REPEATS) {
+    verifyRepeats=PROG_REPEATS;
+    verifyResets=RESET_MIN;
+    return;
+  }
+  if (Diag::ACK && repeats!=verifyRepeats) DIAG(F("ACK latency %d packets, validate repeats=%d resets=%d"),
+                                                  ackLatencyMax, repeats, RESET_FAST);
+  verifyRepeats=repeats;
+  verifyResets=RESET_FAST;
+}
+
+void DCC::resetAckLatency() {
+  ackLatencyMax=0;
+  ackLatencyCount=0;
+  verifyRepeats=PROG_REPEATS;
+  verifyResets=RESET_MIN;
+}
 
 // checkRessets return true if the caller should yield back to loop and try later.
 bool DCC::checkResets(uint8_t numResets) {
@@ -753,6 +866,7 @@ void DCC::ackManagerLoop() {
               byte message[] = {cv1(BIT_MANIPULATE, ackManagerCv), cv2(ackManagerCv), instruction };
               DCCWaveform::progTrack.schedulePacket(message, sizeof(message), PROG_REPEATS);
               DCCWaveform::progTrack.setAckPending(); 
+              ackManagerVerifying=false;
              callbackState=AFTER_WRITE;
          }
             break; 
@@ -764,29 +878,32 @@ void DCC::ackManagerLoop() {
               byte message[] = {cv1(WRITE_BYTE, ackManagerCv), cv2(ackManagerCv), ackManagerByte};
               DCCWaveform::progTrack.schedulePacket(message, sizeof(message), PROG_REPEATS);
               DCCWaveform::progTrack.setAckPending(); 
+              ackManagerVerifying=false;
               callbackState=AFTER_WRITE;
             }
             break;
       
       case   VB:     // Issue validate Byte packet
         {
-	  if (checkResets( RESET_MIN)) return; 
+	  if (checkResets(verifyResets)) return; 
           if (Diag::ACK) DIAG(F("VB cv=%d value=%d"),ackManagerCv,ackManagerByte);
           byte message[] = { cv1(VERIFY_BYTE, ackManagerCv), cv2(ackManagerCv), ackManagerByte};
-          DCCWaveform::progTrack.schedulePacket(message, sizeof(message), PROG_REPEATS);
-          DCCWaveform::progTrack.setAckPending(); 
+          DCCWaveform::progTrack.schedulePacket(message, sizeof(message), verifyRepeats);
+          DCCWaveform::progTrack.setAckPending();
+          ackManagerVerifying=true;
         }
         break;
       
       case V0:
       case V1:      // Issue validate bit=0 or bit=1  packet
         {
-	  if (checkResets(RESET_MIN)) return; 
+	  if (checkResets(verifyResets)) return; 
           if (Diag::ACK) DIAG(F("V%d cv=%d bit=%d"),opcode==V1, ackManagerCv,ackManagerBitNum); 
           byte instruction = VERIFY_BIT | (opcode==V0?BIT_OFF:BIT_ON) | ackManagerBitNum;
           byte message[] = {cv1(BIT_MANIPULATE, ackManagerCv), cv2(ackManagerCv), instruction };
-          DCCWaveform::progTrack.schedulePacket(message, sizeof(message), PROG_REPEATS);
-          DCCWaveform::progTrack.setAckPending(); 
+          DCCWaveform::progTrack.schedulePacket(message, sizeof(message), verifyRepeats);
+          DCCWaveform::progTrack.setAckPending();
+          ackManagerVerifying=true;
         }
         break;
       
@@ -797,6 +914,7 @@ void DCC::ackManagerLoop() {
           ackState=DCCWaveform::progTrack.getAck();
           if (ackState==2) return; // keep polling
           ackReceived=ackState==1;
+          if (ackReceived && ackManagerVerifying) learnAckLatency();
           break;  // we have a genuine ACK result
          }
      case ITC0:
@@ -877,12 +995,12 @@ void DCC::ackManagerLoop() {
           return;            
 
      case ITSKIP:
-          if (!ackReceived) break; 
-          // SKIP opcodes until SKIPTARGET found
-          while (opcode!=SKIPTARGET) {
-            ackManagerProg++; 
-            opcode=GETFLASH(ackManagerProg);
+          // next prog byte is the offset to SKIPTARGET, resolved by ACK_PROGRAM 
+          if (!ackReceived) {
+            ackManagerProg++;  // step over offset
+            break; 
           }
+          ackManagerProg+=GETFLASH(ackManagerProg+1);
           break;
      case SKIPTARGET: 
           break;     
@@ -898,6 +1016,18 @@ void DCC::ackManagerLoop() {
 
 void DCC::callback(int value) {
     static unsigned long callbackStart;
+
+    if (value==-1 && verifyRepeats<PROG_REPEATS) {
+      // Failed on shortened validates, so forget the learned latency 
+      // and run the whole program again the slow way.
+      if (Diag::ACK) DIAG(F("Retry with full repeats"));
+      resetAckLatency();
+      ackManagerProg=ackManagerProgStart;
+      ackManagerByte=ackManagerByteStart;
+      ackManagerBitNum=ackManagerByteStart;
+      return;
+    }
+    
     // We are about to leave programming mode
     // Rule 1: If we have written to a decoder we must maintain power for 100mS
     // Rule 2: If we are re-joining the main track we must power off for 30mS
@@ -948,7 +1078,8 @@ void DCC::callback(int value) {
           }  
     
           ackManagerProg=NULL;  // no more steps to execute
-          if (Diag::ACK) DIAG(F("Callback(%d)"),value);
+          DCCWaveform::progTrack.stopAckBaseline();
+          if (Diag::ACK) DIAG(F("Callback(%d) after %lmS"),value, millis()-ackManagerStart);
           (ackManagerCallback)( value);
     }
 }
@@ -75,6 +75,7 @@ class DCC
 public:
   static void begin(const FSH * motorShieldName, MotorDriver *mainDriver, MotorDriver *progDriver);
   static void setJoinRelayPin(byte joinRelayPin);
+  static bool addDistrict(MotorDriver * driver);  // extra main track power district, call before begin()
   static void loop();
 
   // Public DCC API functions
@@ -87,6 +88,7 @@ public:
   static void setFn(int cab, int16_t functionNumber, bool on);
   static int changeFn(int cab, int16_t functionNumber, bool pressed);
   static int  getFn(int cab, int16_t functionNumber);
+  static bool isRegistered(int cab);  // in the speed table, without adding it
   static void updateGroupflags(byte &flags, int16_t functionNumber);
   static void setAccessory(int aAdd, byte aNum, bool activate);
   static bool writeTextPacket(byte *b, int nBytes);
@@ -112,6 +114,7 @@ public:
   static FSH *getMotorShieldName();
   static inline void setGlobalSpeedsteps(byte s) {
     globalSpeedsteps = s;
+    remindersChanged = true;
   };
 
 private:
@@ -125,6 +128,7 @@ private:
   static byte joinRelay;
   static byte loopStatus;
   static void setThrottle2(uint16_t cab, uint8_t speedCode);
+  static byte speedPacket(byte b[4], uint16_t cab, uint8_t speedCode);
   static void updateLocoReminder(int loco, byte speedCode);
   static void setFunctionInternal(int cab, byte fByte, byte eByte);
   static bool issueReminder(int reg);
@@ -137,6 +141,12 @@ private:
   static byte cv2(int cv);
   static int lookupSpeedTable(int locoId);
   static void issueReminders();
+  static void publishReminders();
+  // Speed packets for the waveform to remind with by itself, double buffered
+  // so the interrupt never sees a half written table.
+  static byte reminderPackets[2][MAX_LOCOS][4];
+  static byte reminderBuffer;      // the one the waveform is not using
+  static bool remindersChanged;
   static void callback(int value);
 
   // ACK MANAGER
@@ -148,6 +158,9 @@ private:
   static byte ackManagerStash;
   static bool ackReceived;
   static bool ackManagerRejoin;
+  static unsigned long ackManagerStart; // millis, for timing complete programming operations
+  static ackOp const *ackManagerProgStart; // for a full retry of the program
+  static byte ackManagerByteStart;
   static ACK_CALLBACK ackManagerCallback;
   static CALLBACK_STATE callbackState;
   static void ackManagerSetup(int cv, byte bitNumOrbyteValue, ackOp const program[], ACK_CALLBACK callback);
@@ -155,6 +168,14 @@ private:
   static void ackManagerLoop();
   static bool checkResets( uint8_t numResets);
   static const int PROG_REPEATS = 8; // repeats of programming commands (some decoders need at least 8 to be reliable)
+  // Learned decoder response, applied to validate packets only
+  static byte verifyRepeats;
+  static byte verifyResets;
+  static byte ackLatencyMax;   // most validate packets sent before an ACK
+  static byte ackLatencyCount; // ACKs observed so far
+  static bool ackManagerVerifying; // last packet was a validate, not a write
+  static void learnAckLatency();
+  static void resetAckLatency();
   
   // NMRA codes #
   static const byte SET_SPEED = 0x3f;
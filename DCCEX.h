@@ -29,6 +29,7 @@
 #include "DCC.h"
 #include "DIAG.h"
 #include "DCCEXParser.h"
+#include "CurrentMeters.h"
 #include "version.h"
 #include "WifiInterface.h"
 #if ETHERNET_ON == true
@@ -37,6 +38,7 @@
 #include "LCD_Implementation.h"
 #include "LCN.h"
 #include "freeMemory.h"
+#include "CommandRecorder.h"
 
 #if __has_include ( "myAutomation.h")
   #include "RMFT.h"
@@ -21,6 +21,12 @@
 #include "DCCEXParser.h"
 #include "DCC.h"
 #include "DCCWaveform.h"
+#include "CurrentMeters.h"
+#include "BinaryProtocol.h"
+#include "PowerLog.h"
+#include "Profiler.h"
+#include "CommandRecorder.h"
+#include "SimulatedDecoder.h"
 #include "Turnouts.h"
 #include "Outputs.h"
 #include "Sensors.h"
@@ -30,35 +36,12 @@
 
 #include "EEStore.h"
 #include "DIAG.h"
+#include "Keywords.h"
 #include <avr/wdt.h>
 
-// These keywords are used in the <1> command. The number is what you get if you use the keyword as a parameter.
-// To discover new keyword numbers , use the <$ YOURKEYWORD> command
-const int16_t HASH_KEYWORD_PROG = -29718;
-const int16_t HASH_KEYWORD_MAIN = 11339;
-const int16_t HASH_KEYWORD_JOIN = -30750;
-const int16_t HASH_KEYWORD_CABS = -11981;
-const int16_t HASH_KEYWORD_RAM = 25982;
-const int16_t HASH_KEYWORD_CMD = 9962;
-const int16_t HASH_KEYWORD_WIT = 31594;
-const int16_t HASH_KEYWORD_WIFI = -5583;
-const int16_t HASH_KEYWORD_ACK = 3113;
-const int16_t HASH_KEYWORD_ON = 2657;
-const int16_t HASH_KEYWORD_DCC = 6436;
-const int16_t HASH_KEYWORD_SLOW = -17209;
-const int16_t HASH_KEYWORD_PROGBOOST = -6353;
-const int16_t HASH_KEYWORD_EEPROM = -7168;
-const int16_t HASH_KEYWORD_LIMIT = 27413;
-const int16_t HASH_KEYWORD_ETHERNET = -30767;    
-const int16_t HASH_KEYWORD_MAX = 16244;
-const int16_t HASH_KEYWORD_MIN = 15978;
-const int16_t HASH_KEYWORD_LCN = 15137;   
-const int16_t HASH_KEYWORD_RESET = 26133;
-const int16_t HASH_KEYWORD_SPEED28 = -17064;
-const int16_t HASH_KEYWORD_SPEED128 = 25816;
-
-int16_t DCCEXParser::stashP[MAX_COMMAND_PARAMS];
+COMMAND_PARAM DCCEXParser::stashP[MAX_COMMAND_PARAMS];
 bool DCCEXParser::stashBusy;
+bool DCCEXParser::stashBinary;
 
 Print *DCCEXParser::stashStream = NULL;
 RingStream *DCCEXParser::stashRingStream = NULL;
@@ -77,43 +60,64 @@ void DCCEXParser::flush()
         DIAG(F("Buffer flush"));
     bufferLength = 0;
     inCommandPayload = false;
+    commandOverflow = false;
 }
 
 void DCCEXParser::loop(Stream &stream)
 {
+    unsigned long startTime = micros();
     while (stream.available())
     {
-        if (bufferLength == MAX_BUFFER)
-        {
-            flush();
-        }
         char ch = stream.read();
         if (ch == '<')
         {
             inCommandPayload = true;
+            commandOverflow = false;
             bufferLength = 0;
             buffer[0] = '\0';
         }
         else if (ch == '>')
         {
+            if (commandOverflow)
+            {
+                // Tell the sender rather than run what was left of it
+                DIAG(F("Command too long, max %d"), MAX_BUFFER);
+                StringFormatter::send(&stream, F("<X>\n"));
+                flush();
+                continue;
+            }
             buffer[bufferLength] = '\0';
+            RECORD_COMMAND(RECORD_SERIAL, buffer, bufferLength);
+            PROFILE_COMMAND_START();
+            PROFILE_MICROS_START(parseStart);
             parse(&stream, buffer, NULL); // Parse this (No ringStream for serial)
+            PROFILE_MICROS_END(parseStart, PROFILE_PARSE);
+            PROFILE_COMMAND_END();
             inCommandPayload = false;
-            break;
+            if (micros() - startTime >= COMMAND_BUDGET_MICROS)
+                break;
         }
-        else if (inCommandPayload)
+        else if (inCommandPayload && !commandOverflow)
         {
-            buffer[bufferLength++] = ch;
+            if (bufferLength == MAX_BUFFER)
+                commandOverflow = true;
+            else
+                buffer[bufferLength++] = ch;
         }
     }
     Sensor::checkAll(&stream); // Update and print changes
 }
 
-int16_t DCCEXParser::splitValues(int16_t result[MAX_COMMAND_PARAMS], const byte *cmd)
+// Largest value a decimal or hex parameter may have before it is too big for COMMAND_PARAM
+static const COMMAND_PARAM MAX_PARAM_VALUE = sizeof(COMMAND_PARAM)==4 ? (COMMAND_PARAM)0x7FFFFFFFL : (COMMAND_PARAM)0x7FFF;
+
+int16_t DCCEXParser::splitValues(COMMAND_PARAM result[MAX_COMMAND_PARAMS], const byte *cmd)
 {
     byte state = 1;
     byte parameterCount = 0;
-    int16_t runningValue = 0;
+    COMMAND_PARAM runningValue = 0;
+    uint16_t keywordValue = 0;
+    bool isKeyword = false;
     const byte *remainingCmd = cmd + 1; // skips the opcode
     bool signNegative = false;
 
@@ -121,7 +125,7 @@ int16_t DCCEXParser::splitValues(int16_t result[MAX_COMMAND_PARAMS], const byte
     for (int16_t i = 0; i < MAX_COMMAND_PARAMS; i++)
         result[i] = 0;
 
-    while (parameterCount < MAX_COMMAND_PARAMS)
+    while (true)
     {
         byte hot = *remainingCmd;
 
@@ -133,12 +137,17 @@ int16_t DCCEXParser::splitValues(int16_t result[MAX_COMMAND_PARAMS], const byte
                 break;
             if (hot == '\0' || hot == '>')
                 return parameterCount;
+            if (hot != '-' && !(hot >= '0' && hot <= '9') && !(hot >= 'a' && hot <= 'z') && !(hot >= 'A' && hot <= 'Z'))
+                return MAX_COMMAND_PARAMS; // not parameters, eg the text of <+AT...>, counted as full as it always was
+            if (parameterCount == MAX_COMMAND_PARAMS)
+                return TOO_MANY_PARAMS;
             state = 2;
             continue;
 
         case 2: // checking sign
             signNegative = false;
             runningValue = 0;
+            isKeyword = false;
             state = 3;
             if (hot != '-')
                 continue;
@@ -147,17 +156,27 @@ int16_t DCCEXParser::splitValues(int16_t result[MAX_COMMAND_PARAMS], const byte
         case 3: // building a parameter
             if (hot >= '0' && hot <= '9')
             {
-                runningValue = 10 * runningValue + (hot - '0');
+                if (isKeyword)
+                    keywordValue = keywordStep(keywordValue, hot);
+                else if (runningValue > (MAX_PARAM_VALUE - (hot - '0')) / 10)
+                    return VALUE_TOO_BIG;
+                else
+                    runningValue = 10 * runningValue + (hot - '0');
                 break;
             }
-            if (hot >= 'a' && hot <= 'z') hot=hot-'a'+'A'; // uppercase a..z
-            if (hot >= 'A' && hot <= 'Z')
+            if ((hot >= 'a' && hot <= 'z') || (hot >= 'A' && hot <= 'Z'))
             {
                 // Since JMRI got modified to send keywords in some rare cases, we need this
-                // Super Kluge to turn keywords into a hash value that can be recognised later
-                runningValue = ((runningValue << 5) + runningValue) ^ hot;
+                // Super Kluge to turn keywords into a 16 bit hash value that can be recognised later
+                // (keywordHash in Keywords.h does the same sum)
+                if (!isKeyword)
+                    keywordValue = (uint16_t)runningValue;
+                isKeyword = true;
+                keywordValue = keywordStep(keywordValue, hot);
                 break;
             }
+            if (isKeyword)
+                runningValue = (int16_t)keywordValue;
             result[parameterCount] = runningValue * (signNegative ? -1 : 1);
             parameterCount++;
             state = 1;
@@ -165,21 +184,20 @@ int16_t DCCEXParser::splitValues(int16_t result[MAX_COMMAND_PARAMS], const byte
         }
         remainingCmd++;
     }
-    return parameterCount;
 }
 
-int16_t DCCEXParser::splitHexValues(int16_t result[MAX_COMMAND_PARAMS], const byte *cmd)
+int16_t DCCEXParser::splitHexValues(COMMAND_PARAM result[MAX_COMMAND_PARAMS], const byte *cmd)
 {
     byte state = 1;
     byte parameterCount = 0;
-    int16_t runningValue = 0;
+    COMMAND_PARAM runningValue = 0;
     const byte *remainingCmd = cmd + 1; // skips the opcode
     
     // clear all parameters in case not enough found
     for (int16_t i = 0; i < MAX_COMMAND_PARAMS; i++)
         result[i] = 0;
 
-    while (parameterCount < MAX_COMMAND_PARAMS)
+    while (true)
     {
         byte hot = *remainingCmd;
 
@@ -191,6 +209,8 @@ int16_t DCCEXParser::splitHexValues(int16_t result[MAX_COMMAND_PARAMS], const by
                 break;
             if (hot == '\0' || hot == '>')
                 return parameterCount;
+            if (parameterCount == MAX_COMMAND_PARAMS)
+                return TOO_MANY_PARAMS;
             state = 2;
             continue;
 
@@ -200,37 +220,47 @@ int16_t DCCEXParser::splitHexValues(int16_t result[MAX_COMMAND_PARAMS], const by
             continue;
 
         case 3: // building a parameter
-            if (hot >= '0' && hot <= '9')
-            {
-                runningValue = 16 * runningValue + (hot - '0');
-                break;
-            }
-            if (hot >= 'A' && hot <= 'F')
-            {
-                runningValue = 16 * runningValue + 10 + (hot - 'A');
-                break;
-            }
-            if (hot >= 'a' && hot <= 'f')
-            {
-                runningValue = 16 * runningValue + 10 + (hot - 'a');
-                break;
-            }
             if (hot==' ' || hot=='>' || hot=='\0') { 
                result[parameterCount] = runningValue;
                parameterCount++;
                state = 1;
                continue;
             }
-            return -1; // invalid hex digit
+            byte digit;
+            if (hot >= '0' && hot <= '9') digit = hot - '0';
+            else if (hot >= 'A' && hot <= 'F') digit = 10 + (hot - 'A');
+            else if (hot >= 'a' && hot <= 'f') digit = 10 + (hot - 'a');
+            else return INVALID_HEX;
+            if (runningValue > (MAX_PARAM_VALUE >> 4))
+                return VALUE_TOO_BIG;
+            runningValue = 16 * runningValue + digit;
+            break;
         }
         remainingCmd++;
     }
-    return parameterCount;
+}
+
+// Says why a command could not be split. The caller sends the <X>.
+void DCCEXParser::splitError(Print * stream, int16_t error, byte opcode)
+{
+    (void)stream;
+    switch (error) {
+        case TOO_MANY_PARAMS:
+            DIAG(F("Command %c has too many parameters, max %d"), opcode, MAX_COMMAND_PARAMS);
+            break;
+        case VALUE_TOO_BIG:
+            DIAG(F("Command %c has a parameter too big for %d bits"), opcode, (int)sizeof(COMMAND_PARAM)*8);
+            break;
+        case INVALID_HEX:
+            DIAG(F("Command %c has an invalid hex parameter"), opcode);
+            break;
+    }
 }
 
 FILTER_CALLBACK DCCEXParser::filterCallback = 0;
 FILTER_CALLBACK DCCEXParser::filterRMFTCallback = 0;
-AT_COMMAND_CALLBACK DCCEXParser::atCommandCallback = 0;
+const COMMAND_ENTRY * DCCEXParser::commandTables[MAX_COMMAND_TABLES];
+byte DCCEXParser::commandTableCount = 0;
 void DCCEXParser::setFilter(FILTER_CALLBACK filter)
 {
     filterCallback = filter;
@@ -239,10 +269,6 @@ void DCCEXParser::setRMFTFilter(FILTER_CALLBACK filter)
 {
     filterRMFTCallback = filter;
 }
-void DCCEXParser::setAtCommandCallback(AT_COMMAND_CALLBACK callback)
-{
-    atCommandCallback = callback;
-}
 
 // Parse an F() string 
 void DCCEXParser::parse(const FSH * cmd) {
@@ -258,311 +284,520 @@ void DCCEXParser::parse(Print *stream, byte *com, RingStream * ringStream)
     (void)EEPROM; // tell compiler not to warn this is unused
     if (Diag::CMD)
         DIAG(F("PARSING:%s"), com);
-    int16_t p[MAX_COMMAND_PARAMS];
+    COMMAND_PARAM p[MAX_COMMAND_PARAMS];
     while (com[0] == '<' || com[0] == ' ')
         com++; // strip off any number of < or spaces
-    byte params = splitValues(p, com);
+    PROFILE_MICROS_START(splitStart);
+    int16_t params = splitValues(p, com);
+    PROFILE_MICROS_END(splitStart, PROFILE_SPLITVALUES);
     byte opcode = com[0];
 
+    // Any fallout here sends an <X>, unless the command only wants its text, eg <+AT...>
+    if (params < 0)
+    {
+        if (!takesText(opcode)) {
+            splitError(stream, params, opcode);
+            StringFormatter::send(stream, F("<X>\n"));
+            return;
+        }
+        params = TEXT_PARAMS;
+    }
+    if (!execute(stream, opcode, params, p, com, ringStream))
+        StringFormatter::send(stream, F("<X>\n"));
+}
+
+// Runs a split command, text or binary, through the filters and the command tables.
+// com is NULL for binary commands. Returns false if the command failed.
+bool DCCEXParser::execute(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream * ringStream)
+{
     if (filterCallback)
         filterCallback(stream, opcode, params, p);
     if (filterRMFTCallback && opcode!='\0')
         filterRMFTCallback(stream, opcode, params, p);
+    if (opcode == '\0')
+        return true; // filterCallback asked us to ignore
+
+    // Added tables are searched before the built in commands so a module can take over an opcode
+    COMMAND_ENTRY entry;
+    const COMMAND_ENTRY * table=NULL;
+    int index=-1;
+    bool opcodeKnown=false;
+    for (byte t=0; t<=commandTableCount && index<0; t++) {
+        table = t<commandTableCount ? commandTables[t] : commandTable;
+        index = findCommand(table, opcode, params, entry, opcodeKnown);
+    }
 
-    // Functions return from this switch if complete, break from switch implies error <X> to send
-    switch (opcode)
-    {
-    case '\0':
-        return; // filterCallback asked us to ignore
-    case 't':   // THROTTLE <t [REGISTER] CAB SPEED DIRECTION>
-    {
-        int16_t cab;
-        int16_t tspeed;
-        int16_t direction;
-
-        if (params == 4)
-        { // <t REGISTER CAB SPEED DIRECTION>
-            cab = p[1];
-            tspeed = p[2];
-            direction = p[3];
-        }
-        else if (params == 3)
-        { // <t CAB SPEED DIRECTION>
-            cab = p[0];
-            tspeed = p[1];
-            direction = p[2];
-        }
-        else
-            break;
+    if (index>=0) {
+#ifdef ENABLE_PROFILER
+        if (table==commandTable && commandHits[index]<65535) commandHits[index]++;
+#endif
+        return entry.handler(stream, opcode, params, p, com, ringStream);
+    }
+    if (!opcodeKnown) { //anything else will diagnose and drop out
+        DIAG(F("Opcode=%c params=%d"), opcode, params);
+        for (int i = 0; i < params && i < MAX_COMMAND_PARAMS; i++)
+            DIAG(F("p[%d]=%l (0x%x)"), i, (long)p[i], (int)p[i]);
+    }
+    return false;
+}
 
-        // Convert DCC-EX protocol speed steps where
-        // -1=emergency stop, 0-126 as speeds
-        // to DCC 0=stop, 1= emergency stop, 2-127 speeds
-        if (tspeed > 126 || tspeed < -1)
-            break; // invalid JMRI speed code
-        if (tspeed < 0)
-            tspeed = 1; // emergency stop DCC speed
-        else if (tspeed > 0)
-            tspeed++; // map 1-126 -> 2-127
-        if (cab == 0 && tspeed > 1)
-            break; // ignore broadcasts of speed>1
-
-        if (direction < 0 || direction > 1)
-            break; // invalid direction code
-
-        DCC::setThrottle(cab, tspeed, direction);
-        if (params == 4)
-            StringFormatter::send(stream, F("<T %d %d %d>\n"), p[0], p[2], p[3]);
-        else
-            StringFormatter::send(stream, F("<O>\n"));
-        return;
+// Index of the first entry matching opcode and params, or -1 with opcodeKnown set if only the opcode matched
+int DCCEXParser::findCommand(const COMMAND_ENTRY * table, byte opcode, byte params, COMMAND_ENTRY & entry, bool & opcodeKnown)
+{
+    for (int i=0; ; i++) {
+        byte tableOpcode=GETFLASH(&table[i].opcode);
+        if (tableOpcode == '\0')
+            return -1;
+        if (tableOpcode != opcode)
+            continue;
+        memcpy_P(&entry, &table[i], sizeof(COMMAND_ENTRY));
+        opcodeKnown=true;
+        if (params >= entry.minParams && params <= entry.maxParams)
+            return i;
     }
-    case 'f': // FUNCTION <f CAB BYTE1 [BYTE2]>
-        if (parsef(stream, params, p))
-            return;
-        break;
+}
 
-    case 'a': // ACCESSORY <a ADDRESS SUBADDRESS ACTIVATE> or <a LINEARADDRESS ACTIVATE>
-        { 
-          int address;
-          byte subaddress;
-          byte activep;
-          if (params==2) { // <a LINEARADDRESS ACTIVATE>
-              address=(p[0] - 1) / 4 + 1;
-              subaddress=(p[0] - 1)  % 4;
-              activep=1;        
-          }
-          else if (params==3) { // <a ADDRESS SUBADDRESS ACTIVATE>
-              address=p[0];
-              subaddress=p[1];
-              activep=2;        
-          }
-          else break; // invalid no of parameters
-          
-          if (
-             ((address & 0x01FF) != address)      // invalid address (limit 9 bits ) 
-          || ((subaddress & 0x03) != subaddress)  // invalid subaddress (limit 2 bits ) 
-          || ((p[activep]  & 0x01) != p[activep]) // invalid activate 0|1
-          ) break; 
-            
-          DCC::setAccessory(address, subaddress,p[activep]==1);
-        }
-        return;
-     
-    case 'T': // TURNOUT  <T ...>
-        if (parseT(stream, params, p))
-            return;
-        break;
+// True if a command table has a TEXT_PARAMS row for opcode
+bool DCCEXParser::takesText(byte opcode)
+{
+    COMMAND_ENTRY entry;
+    bool opcodeKnown=false;
+    for (byte t=0; t<=commandTableCount; t++) {
+        if (findCommand(t<commandTableCount ? commandTables[t] : commandTable, opcode, TEXT_PARAMS, entry, opcodeKnown) >= 0)
+            return true;
+    }
+    return false;
+}
 
-    case 'Z': // OUTPUT <Z ...>
-        if (parseZ(stream, params, p))
-            return;
-        break;
+bool DCCEXParser::addCommands(const COMMAND_ENTRY * table)
+{
+    if (commandTableCount >= MAX_COMMAND_TABLES)
+        return false;
+    commandTables[commandTableCount++]=table;
+    return true;
+}
 
-    case 'S': // SENSOR <S ...>
-        if (parseS(stream, params, p))
-            return;
-        break;
+#ifdef ENABLE_PROFILER
+void DCCEXParser::dumpCommandHits(Print * stream)
+{
+    for (byte i = 0; GETFLASH(&commandTable[i].opcode) != '\0'; i++)
+        StringFormatter::send(stream, F("COMMAND %c %d %d %d\n"), GETFLASH(&commandTable[i].opcode),
+            GETFLASH(&commandTable[i].minParams), GETFLASH(&commandTable[i].maxParams), commandHits[i]);
+}
 
-    case 'w': // WRITE CV on MAIN <w CAB CV VALUE>
-        DCC::writeCVByteMain(p[0], p[1], p[2]);
-        return;
+// Swallows benchmark replies
+class BenchPrint : public Print {
+  public:
+    virtual size_t write(uint8_t b) { (void)b; return 1; }
+    using Print::write;
+};
+
+extern char * __brkval;
+
+// Runs statement BENCH_ITERATIONS times and prints one JSON object per line
+//    {"bench":"name","iter":iterations,"ns":ns/op,"heap":heapbytes}
+// The time includes the loop and any interrupts, heapbytes is how far the heap grew.
+#define BENCH_ITERATIONS 1000
+#define BENCH(name, statement) { \
+    char * heapStart=__brkval; \
+    unsigned long benchStart=micros(); \
+    for (int benchLoop=0; benchLoop<BENCH_ITERATIONS; benchLoop++) { statement; } \
+    unsigned long benchTime=micros()-benchStart; \
+    StringFormatter::send(stream, F("{\"bench\":\"%S\",\"iter\":%d,\"ns\":%l,\"heap\":%d}\n"), \
+        F(name), BENCH_ITERATIONS, \
+        benchTime*1000UL/BENCH_ITERATIONS, (int)(__brkval-heapStart)); }
+
+// <D PROFILE BENCH [cab]> times the command and reply hot paths on the board
+void DCCEXParser::benchmark(Print * stream, int16_t cab)
+{
+    static const char command[] = "t 1 3 50 1";
+    static const char hexCommand[] = "M 0 C4 3F 7F";
+    DCCEXParser parser;
+    COMMAND_PARAM p[MAX_COMMAND_PARAMS];
+    BenchPrint sink;
+    static RingStream * ring = new RingStream(256);  // once, before any heap is measured
+    int sum = 0;  // keeps the results in use
+
+    BENCH("splitValues", sum += parser.splitValues(p, (const byte *)command));
+    BENCH("splitHexValues", sum += splitHexValues(p, (const byte *)hexCommand));
+    BENCH("sendT", StringFormatter::send(&sink, F("<T %d %d %d>\n"), 1, 3, 50));
+    BENCH("sendH", StringFormatter::send(&sink, F("<H %d %d>\n"), 17, 1));
+    BENCH("ringMessage",
+        ring->mark(1);
+        ring->print(F("<T 1 3 50>\n"));
+        ring->commit();
+        ring->read();
+        for (int n = ring->count(); n > 0; n--) sum += ring->read());
+    // Only a cab already in the speed table, so the lookup never adds one
+    if (DCC::isRegistered(cab)) {
+        BENCH("getFn", sum += DCC::getFn(cab, 0));
+    }
+    else StringFormatter::send(stream, F("{\"bench\":\"getFn\",\"skipped\":\"cab %d not registered\"}\n"), cab);
+    if (sum == 0x7FFF) DIAG(F("BENCH %d"), sum);
+}
+#endif
+
+// The built in commands, in the order they are looked up.
+// Where an opcode has more than one entry the parameter count picks the handler.
+const COMMAND_ENTRY DCCEXParser::commandTable[] FLASH = {
+    {'t', 3, 4, parseThrottle},              // THROTTLE <t [REGISTER] CAB SPEED DIRECTION>
+    {'f', 0, MAX_COMMAND_PARAMS, parsef},    // FUNCTION <f CAB BYTE1 [BYTE2]>
+    {'F', 0, MAX_COMMAND_PARAMS, parseFunction}, // <F cab func 1|0>
+    {'a', 2, 3, parseAccessory},             // ACCESSORY <a ADDRESS SUBADDRESS ACTIVATE> or <a LINEARADDRESS ACTIVATE>
+    {'T', 0, 3, parseT},                     // TURNOUT  <T ...>
+    {'Z', 0, 3, parseZ},                     // OUTPUT <Z ...>
+    {'S', 0, 3, parseS},                     // SENSOR <S ...>
+    {'w', 0, MAX_COMMAND_PARAMS, parseWriteCVMain},     // <w CAB CV VALUE>
+    {'b', 0, MAX_COMMAND_PARAMS, parseWriteCVBitMain},  // <b CAB CV BIT VALUE>
+    {'M', 2, MAX_COMMAND_PARAMS, parsePacket},  // <M REG X1 ... X9>
+    {'P', 2, MAX_COMMAND_PARAMS, parsePacket},  // <P REG X1 ... X9>
+    {'W', 1, 1, parseWriteLocoId},           // <W id>
+    {'W', 2, MAX_COMMAND_PARAMS, parseWriteCV}, // <W CV VALUE [CALLBACKNUM] [CALLBACKSUB]>
+    {'V', 2, 2, parseVerifyCVByte},          // <V CV VALUE>
+    {'V', 3, 3, parseVerifyCVBit},           // <V CV BIT 0|1>
+    {'B', 0, MAX_COMMAND_PARAMS, parseWriteCVBit}, // <B CV BIT VALUE CALLBACKNUM CALLBACKSUB>
+    {'R', 0, 0, parseReadLocoId},            // <R>
+    {'R', 3, 3, parseReadCV},                // <R CV CALLBACKNUM CALLBACKSUB>
+    {'1', 0, 1, parsePower},                 // POWERON <1 [MAIN|PROG|JOIN|district]>
+    {'0', 0, 1, parsePower},                 // POWEROFF <0 [MAIN|PROG|district]>
+    {'!', 0, MAX_COMMAND_PARAMS, parseEstop},   // <!>
+    {'c', 0, MAX_COMMAND_PARAMS, parseMeters},  // <c> or <c interval>
+    {'Q', 0, MAX_COMMAND_PARAMS, parseSensorStates}, // <Q>
+    {'s', 0, MAX_COMMAND_PARAMS, parseStatus},  // <s>
+    {'E', 0, MAX_COMMAND_PARAMS, parseStoreEEPROM}, // <E>
+    {'e', 0, MAX_COMMAND_PARAMS, parseClearEEPROM}, // <e>
+    {' ', 0, MAX_COMMAND_PARAMS, parseEmpty},   // < >
+    {'D', 0, MAX_COMMAND_PARAMS, parseDiag},    // <D ...>
+    {'#', 0, MAX_COMMAND_PARAMS, parseLocoSlots}, // <#>
+    {'-', 0, 1, parseForget},                // <- [cab]>
+    {'\0', 0, 0, NULL}
+};
+
+#ifdef ENABLE_PROFILER
+unsigned int DCCEXParser::commandHits[sizeof(commandTable)/sizeof(commandTable[0])];
+#endif
+
+bool DCCEXParser::parseThrottle(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    int16_t cab;
+    int16_t tspeed;
+    int16_t direction;
+
+    if (params == 4)
+    { // <t REGISTER CAB SPEED DIRECTION>
+        cab = p[1];
+        tspeed = p[2];
+        direction = p[3];
+    }
+    else
+    { // <t CAB SPEED DIRECTION>
+        cab = p[0];
+        tspeed = p[1];
+        direction = p[2];
+    }
 
-    case 'b': // WRITE CV BIT ON MAIN <b CAB CV BIT VALUE>
-        DCC::writeCVBitMain(p[0], p[1], p[2], p[3]);
-        return;
+    // Convert DCC-EX protocol speed steps where
+    // -1=emergency stop, 0-126 as speeds
+    // to DCC 0=stop, 1= emergency stop, 2-127 speeds
+    if (tspeed > 126 || tspeed < -1)
+        return false; // invalid JMRI speed code
+    if (tspeed < 0)
+        tspeed = 1; // emergency stop DCC speed
+    else if (tspeed > 0)
+        tspeed++; // map 1-126 -> 2-127
+    if (cab == 0 && tspeed > 1)
+        return false; // ignore broadcasts of speed>1
+
+    if (direction < 0 || direction > 1)
+        return false; // invalid direction code
+
+    DCC::setThrottle(cab, tspeed, direction);
+    if (params == 4)
+        StringFormatter::send(stream, F("<T %d %d %d>\n"), (int)p[0], (int)p[2], (int)p[3]);
+    else
+        StringFormatter::send(stream, F("<O>\n"));
+    return true;
+}
 
-    case 'M': // WRITE TRANSPARENT DCC PACKET MAIN <M REG X1 ... X9>
-    case 'P': // WRITE TRANSPARENT DCC PACKET PROG <P REG X1 ... X9>
-        // Re-parse the command using a hex-only splitter
-        params=splitHexValues(p,com)-1; // drop REG
-        if (params<1) break;  
-        {
-          byte packet[params];
-          for (int i=0;i<params;i++) {
-            packet[i]=(byte)p[i+1];
-            if (Diag::CMD) DIAG(F("packet[%d]=%d (0x%x)"), i, packet[i], packet[i]);
-          }
-          (opcode=='M'?DCCWaveform::mainTrack:DCCWaveform::progTrack).schedulePacket(packet,params,3);  
-        }
-        return;
-        
-    case 'W': // WRITE CV ON PROG <W CV VALUE CALLBACKNUM CALLBACKSUB>
-            if (!stashCallback(stream, p, ringStream))
-                break;
-        if (params == 1) // <W id> Write new loco id (clearing consist and managing short/long)
-            DCC::setLocoId(p[0],callback_Wloco);
-        else // WRITE CV ON PROG <W CV VALUE [CALLBACKNUM] [CALLBACKSUB]>
-            DCC::writeCVByte(p[0], p[1], callback_W);
-        return;
-
-    case 'V': // VERIFY CV ON PROG <V CV VALUE> <V CV BIT 0|1>
-        if (params == 2)
-        { // <V CV VALUE>
-            if (!stashCallback(stream, p, ringStream))
-                break;
-            DCC::verifyCVByte(p[0], p[1], callback_Vbyte);
-            return;
+bool DCCEXParser::parseAccessory(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    int address;
+    byte subaddress;
+    byte activep;
+    if (params==2) { // <a LINEARADDRESS ACTIVATE>
+        address=(p[0] - 1) / 4 + 1;
+        subaddress=(p[0] - 1)  % 4;
+        activep=1;        
+    }
+    else { // <a ADDRESS SUBADDRESS ACTIVATE>
+        address=p[0];
+        subaddress=p[1];
+        activep=2;        
+    }
+    
+    if (
+       ((address & 0x01FF) != address)      // invalid address (limit 9 bits ) 
+    || ((subaddress & 0x03) != subaddress)  // invalid subaddress (limit 2 bits ) 
+    || ((p[activep]  & 0x01) != p[activep]) // invalid activate 0|1
+    ) return false; 
+      
+    DCC::setAccessory(address, subaddress,p[activep]==1);
+    return true;
+}
+
+bool DCCEXParser::parseWriteCVMain(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    DCC::writeCVByteMain(p[0], p[1], p[2]);
+    return true;
+}
+
+bool DCCEXParser::parseWriteCVBitMain(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    DCC::writeCVBitMain(p[0], p[1], p[2], p[3]);
+    return true;
+}
+
+// WRITE TRANSPARENT DCC PACKET MAIN <M REG X1 ... X9> or PROG <P REG X1 ... X9>
+bool DCCEXParser::parsePacket(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    // Re-parse a text command using a hex-only splitter, binary ones are already values
+    int16_t split= com ? splitHexValues(p,com) : params;
+    if (split<0) {
+      splitError(stream, split, opcode);
+      return false;
+    }
+    int16_t count= split - 1; // drop REG
+    if (count<1) return false;  
+    byte packet[count];
+    for (int i=0;i<count;i++) {
+      if (p[i+1]<0 || p[i+1]>0xFF) {
+        DIAG(F("Packet byte %d is not 00-FF"), i);
+        return false;
+      }
+      packet[i]=(byte)p[i+1];
+      if (Diag::CMD) DIAG(F("packet[%d]=%d (0x%x)"), i, packet[i], packet[i]);
+    }
+    (opcode=='M'?DCCWaveform::mainTrack:DCCWaveform::progTrack).schedulePacket(packet,count,3);  
+    return true;
+}
+
+// <W id> Write new loco id (clearing consist and managing short/long)
+bool DCCEXParser::parseWriteLocoId(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (!stashCallback(stream, p, com, ringStream))
+        return false;
+    DCC::setLocoId(p[0],callback_Wloco);
+    return true;
+}
+
+// WRITE CV ON PROG <W CV VALUE [CALLBACKNUM] [CALLBACKSUB]>
+bool DCCEXParser::parseWriteCV(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (!stashCallback(stream, p, com, ringStream))
+        return false;
+    DCC::writeCVByte(p[0], p[1], callback_W);
+    return true;
+}
+
+bool DCCEXParser::parseVerifyCVByte(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (!stashCallback(stream, p, com, ringStream))
+        return false;
+    DCC::verifyCVByte(p[0], p[1], callback_Vbyte);
+    return true;
+}
+
+bool DCCEXParser::parseVerifyCVBit(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (!stashCallback(stream, p, com, ringStream))
+        return false;
+    DCC::verifyCVBit(p[0], p[1], p[2], callback_Vbit);
+    return true;
+}
+
+bool DCCEXParser::parseWriteCVBit(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (!stashCallback(stream, p, com, ringStream))
+        return false;
+    DCC::writeCVBit(p[0], p[1], p[2], callback_B);
+    return true;
+}
+
+// <R> New read loco id
+bool DCCEXParser::parseReadLocoId(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (!stashCallback(stream, p, com, ringStream))
+        return false;
+    DCC::getLocoId(callback_Rloco);
+    return true;
+}
+
+// READ CV ON PROG <R CV CALLBACKNUM CALLBACKSUB>
+bool DCCEXParser::parseReadCV(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (!stashCallback(stream, p, com, ringStream))
+        return false;
+    DCC::readCV(p[0], callback_R);
+    return true;
+}
+
+// POWERON <1 [MAIN|PROG|JOIN|district]> POWEROFF <0 [MAIN | PROG | district] >
+bool DCCEXParser::parsePower(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    POWERMODE mode = opcode == '1' ? POWERMODE::ON : POWERMODE::OFF;
+    DCC::setProgTrackSyncMain(false); // Only <1 JOIN> will set this on, all others set it off
+    if (params == 0 ||
+	(MotorDriver::commonFaultPin && p[0] != HASH_KEYWORD_JOIN)) // commonFaultPin prevents individual track handling
+    {
+        DCCWaveform::mainTrack.setPowerMode(mode);
+        DCCWaveform::progTrack.setPowerMode(mode);
+        DCCWaveform::setDistrictsPowerMode(mode);
+	if (mode == POWERMODE::OFF)
+	  DCC::setProgTrackBoost(false);  // Prog track boost mode will not outlive prog track off
+        StringFormatter::send(stream, F("<p%c>\n"), opcode);
+        return true;
+    }
+    if (p[0] >= 1 && p[0] <= DCCWaveform::getDistrictCount()) // checked before it is narrowed
+    {
+        DCCWaveform * district=DCCWaveform::getDistrict(p[0]);
+        if (district) {
+            district->setPowerMode(mode);
+            StringFormatter::send(stream, F("<p%c %d>\n"), opcode, (int)p[0]);
+            return true;
         }
-        if (params == 3)
+    }
+    switch (keyword(p[0]))
+    {
+    case KEYWORD_MAIN:
+        DCCWaveform::mainTrack.setPowerMode(mode);
+        DCCWaveform::setDistrictsPowerMode(mode);
+        StringFormatter::send(stream, F("<p%c MAIN>\n"), opcode);
+        return true;
+
+    case KEYWORD_PROG:
+        DCCWaveform::progTrack.setPowerMode(mode);
+	if (mode == POWERMODE::OFF)
+	  DCC::setProgTrackBoost(false);  // Prog track boost mode will not outlive prog track off
+        StringFormatter::send(stream, F("<p%c PROG>\n"), opcode);
+        return true;
+    case KEYWORD_JOIN:
+        DCCWaveform::mainTrack.setPowerMode(mode);
+        DCCWaveform::progTrack.setPowerMode(mode);
+        DCCWaveform::setDistrictsPowerMode(mode);
+        if (mode == POWERMODE::ON)
         {
-            if (!stashCallback(stream, p, ringStream))
-                break;
-            DCC::verifyCVBit(p[0], p[1], p[2], callback_Vbit);
-            return;
+            DCC::setProgTrackSyncMain(true);
+            StringFormatter::send(stream, F("<p1 JOIN>\n"), opcode);
         }
+        else
+            StringFormatter::send(stream, F("<p0>\n"));
+        return true;
+
+    default:
         break;
+    }
+    return false;
+}
 
-    case 'B': // WRITE CV BIT ON PROG <B CV BIT VALUE CALLBACKNUM CALLBACKSUB>
-        if (!stashCallback(stream, p, ringStream))
-            break;
-        DCC::writeCVBit(p[0], p[1], p[2], callback_B);
-        return;
+// ESTOP ALL  <!>
+bool DCCEXParser::parseEstop(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    DCC::setThrottle(0,1,1); // this broadcasts speed 1(estop) and sets all reminders to speed 1. 
+    return true;
+}
 
-    case 'R': // READ CV ON PROG
-        if (params == 3)
-        { // <R CV CALLBACKNUM CALLBACKSUB>
-            if (!stashCallback(stream, p, ringStream))
-                break;
-            DCC::readCV(p[0], callback_R);
-            return;
-        }
-        if (params == 0)
-        { // <R> New read loco id
-            if (!stashCallback(stream, p, ringStream))
-                break;
-            DCC::getLocoId(callback_Rloco);
-            return;
-        }
-        break;
+// SEND METER RESPONSES <c> or SUBSCRIBE <c interval> (mS, 0 to stop)
+bool DCCEXParser::parseMeters(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (params==1) {
+        if (p[0]<0) return false;
+        // Pushed meter text has no frame to go in, so binary clients poll instead
+        if (!com) return false;
+        if (!CurrentMeters::subscribe(stream, ringStream, p[0])) return false;
+        if (p[0]>0) CurrentMeters::print(stream);
+        return true;
+    }
+    //                               <c MeterName value C/V unit min max res warn>
+    StringFormatter::send(stream, F("<c CurrentMAIN %d C Milli 0 %d 1 %d>\n"), DCCWaveform::mainTrack.getCurrentmA(), 
+        DCCWaveform::mainTrack.getMaxmA(), DCCWaveform::mainTrack.getTripmA());
+    StringFormatter::send(stream, F("<a %d>\n"), DCCWaveform::mainTrack.get1024Current()); //'a' message deprecated, remove once JMRI 4.22 is available
+    return true;
+}
 
-    case '1': // POWERON <1   [MAIN|PROG]>
-    case '0': // POWEROFF <0 [MAIN | PROG] >
-        if (params > 1)
-            break;
-        {
-            POWERMODE mode = opcode == '1' ? POWERMODE::ON : POWERMODE::OFF;
-            DCC::setProgTrackSyncMain(false); // Only <1 JOIN> will set this on, all others set it off
-            if (params == 0 ||
-		(MotorDriver::commonFaultPin && p[0] != HASH_KEYWORD_JOIN)) // commonFaultPin prevents individual track handling
-            {
-                DCCWaveform::mainTrack.setPowerMode(mode);
-                DCCWaveform::progTrack.setPowerMode(mode);
-		if (mode == POWERMODE::OFF)
-		  DCC::setProgTrackBoost(false);  // Prog track boost mode will not outlive prog track off
-                StringFormatter::send(stream, F("<p%c>\n"), opcode);
-                return;
-            }
-            switch (p[0])
-            {
-            case HASH_KEYWORD_MAIN:
-                DCCWaveform::mainTrack.setPowerMode(mode);
-                StringFormatter::send(stream, F("<p%c MAIN>\n"), opcode);
-                return;
-
-            case HASH_KEYWORD_PROG:
-                DCCWaveform::progTrack.setPowerMode(mode);
-		if (mode == POWERMODE::OFF)
-		  DCC::setProgTrackBoost(false);  // Prog track boost mode will not outlive prog track off
-                StringFormatter::send(stream, F("<p%c PROG>\n"), opcode);
-                return;
-            case HASH_KEYWORD_JOIN:
-                DCCWaveform::mainTrack.setPowerMode(mode);
-                DCCWaveform::progTrack.setPowerMode(mode);
-                if (mode == POWERMODE::ON)
-                {
-                    DCC::setProgTrackSyncMain(true);
-                    StringFormatter::send(stream, F("<p1 JOIN>\n"), opcode);
-                }
-                else
-                    StringFormatter::send(stream, F("<p0>\n"));
-                return;
-            }
-            break;
-        }
-        return;
-
-    case '!': // ESTOP ALL  <!>
-        DCC::setThrottle(0,1,1); // this broadcasts speed 1(estop) and sets all reminders to speed 1. 
-        return;
-
-    case 'c': // SEND METER RESPONSES <c>
-        //                               <c MeterName value C/V unit min max res warn>
-        StringFormatter::send(stream, F("<c CurrentMAIN %d C Milli 0 %d 1 %d>\n"), DCCWaveform::mainTrack.getCurrentmA(), 
-            DCCWaveform::mainTrack.getMaxmA(), DCCWaveform::mainTrack.getTripmA());
-        StringFormatter::send(stream, F("<a %d>\n"), DCCWaveform::mainTrack.get1024Current()); //'a' message deprecated, remove once JMRI 4.22 is available
-        return;
-
-    case 'Q': // SENSORS <Q>
-        Sensor::printAll(stream);
-        return;
-
-    case 's': // <s>
-        StringFormatter::send(stream, F("<p%d>\n"), DCCWaveform::mainTrack.getPowerMode() == POWERMODE::ON);
-        StringFormatter::send(stream, F("<iDCC-EX V-%S / %S / %S G-%S>\n"), F(VERSION), F(ARDUINO_TYPE), DCC::getMotorShieldName(), F(GITHUB_SHA));
-        Turnout::printAll(stream); //send all Turnout states
-        Output::printAll(stream);  //send all Output  states
-        Sensor::printAll(stream);  //send all Sensor  states
-        // TODO Send stats of  speed reminders table
-        return;       
-
-    case 'E': // STORE EPROM <E>
-        EEStore::store();
-        StringFormatter::send(stream, F("<e %d %d %d>\n"), EEStore::eeStore->data.nTurnouts, EEStore::eeStore->data.nSensors, EEStore::eeStore->data.nOutputs);
-        return;
-
-    case 'e': // CLEAR EPROM <e>
-        EEStore::clear();
-        StringFormatter::send(stream, F("<O>\n"));
-        return;
+// SENSORS <Q>
+bool DCCEXParser::parseSensorStates(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    Sensor::printAll(stream);
+    return true;
+}
 
-    case ' ': // < >
-        StringFormatter::send(stream, F("\n"));
-        return;
+bool DCCEXParser::parseStatus(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    StringFormatter::send(stream, F("<p%d>\n"), DCCWaveform::mainTrack.getPowerMode() == POWERMODE::ON);
+    StringFormatter::send(stream, F("<iDCC-EX V-%S / %S / %S G-%S>\n"), F(VERSION), F(ARDUINO_TYPE), DCC::getMotorShieldName(), F(GITHUB_SHA));
+    Turnout::printAll(stream); //send all Turnout states
+    Output::printAll(stream);  //send all Output  states
+    Sensor::printAll(stream);  //send all Sensor  states
+    // TODO Send stats of  speed reminders table
+    return true;
+}
 
-    case 'D': // < >
-        if (parseD(stream, params, p))
-            return;
-        return;
-
-    case '#': // NUMBER OF LOCOSLOTS <#>
-        StringFormatter::send(stream, F("<# %d>\n"), MAX_LOCOS);
-        return;
-
-    case '-': // Forget Loco <- [cab]>
-        if (params > 1 || p[0]<0) break;
-        if (p[0]==0) DCC::forgetAllLocos();
-        else  DCC::forgetLoco(p[0]);
-        return;
-
-    case 'F': // New command to call the new Loco Function API <F cab func 1|0>
-        if (Diag::CMD)
-            DIAG(F("Setting loco %d F%d %S"), p[0], p[1], p[2] ? F("ON") : F("OFF"));
-        DCC::setFn(p[0], p[1], p[2] == 1);
-        return;
-
-    case '+': // Complex Wifi interface command (not usual parse)
-        if (atCommandCallback) {
-          DCCWaveform::mainTrack.setPowerMode(POWERMODE::OFF);
-          DCCWaveform::progTrack.setPowerMode(POWERMODE::OFF);
-          atCommandCallback(com);
-          return;
-        }
-        break;
+// STORE EPROM <E>
+bool DCCEXParser::parseStoreEEPROM(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    EEStore::store();
+    StringFormatter::send(stream, F("<e %d %d %d>\n"), EEStore::eeStore->data.nTurnouts, EEStore::eeStore->data.nSensors, EEStore::eeStore->data.nOutputs);
+    return true;
+}
 
-    default: //anything else will diagnose and drop out to <X>
-        DIAG(F("Opcode=%c params=%d"), opcode, params);
-        for (int i = 0; i < params; i++)
-            DIAG(F("p[%d]=%d (0x%x)"), i, p[i], p[i]);
-        break;
+// CLEAR EPROM <e>
+bool DCCEXParser::parseClearEEPROM(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    EEStore::clear();
+    StringFormatter::send(stream, F("<O>\n"));
+    return true;
+}
+
+// < >
+bool DCCEXParser::parseEmpty(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    StringFormatter::send(stream, F("\n"));
+    return true;
+}
+
+// <D ...> never replies <X>
+bool DCCEXParser::parseDiag(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    parseD(stream, params, p);
+    return true;
+}
+
+// NUMBER OF LOCOSLOTS <#>
+bool DCCEXParser::parseLocoSlots(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    StringFormatter::send(stream, F("<# %d>\n"), MAX_LOCOS);
+    return true;
+}
 
-    } // end of opcode switch
+// Forget Loco <- [cab]>
+bool DCCEXParser::parseForget(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (p[0]<0) return false;
+    if (p[0]==0) DCC::forgetAllLocos();
+    else  DCC::forgetLoco(p[0]);
+    return true;
+}
 
-    // Any fallout here sends an <X>
-    StringFormatter::send(stream, F("<X>\n"));
+// New command to call the new Loco Function API <F cab func 1|0>
+bool DCCEXParser::parseFunction(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
+{
+    if (Diag::CMD)
+        DIAG(F("Setting loco %d F%d %S"), (int)p[0], (int)p[1], p[2] ? F("ON") : F("OFF"));
+    DCC::setFn(p[0], p[1], p[2] == 1);
+    return true;
 }
 
-bool DCCEXParser::parseZ(Print *stream, int16_t params, int16_t p[])
+bool DCCEXParser::parseZ(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
 {
 
     switch (params)
@@ -574,7 +809,7 @@ bool DCCEXParser::parseZ(Print *stream, int16_t params, int16_t p[])
         if (o == NULL)
             return false;
         o->activate(p[1]);
-        StringFormatter::send(stream, F("<Y %d %d>\n"), p[0], p[1]);
+        StringFormatter::send(stream, F("<Y %d %d>\n"), (int)p[0], (int)p[1]);
     }
         return true;
 
@@ -610,7 +845,7 @@ bool DCCEXParser::parseZ(Print *stream, int16_t params, int16_t p[])
 }
 
 //===================================
-bool DCCEXParser::parsef(Print *stream, int16_t params, int16_t p[])
+bool DCCEXParser::parsef(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
 {
     // JMRI sends this info in DCC message format but it's not exactly
     //      convenient for other processing
@@ -652,7 +887,7 @@ void DCCEXParser::funcmap(int16_t cab, byte value, byte fstart, byte fstop)
 }
 
 //===================================
-bool DCCEXParser::parseT(Print *stream, int16_t params, int16_t p[])
+bool DCCEXParser::parseT(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
 {
     switch (params)
     {
@@ -695,7 +930,7 @@ bool DCCEXParser::parseT(Print *stream, int16_t params, int16_t p[])
     }
 }
 
-bool DCCEXParser::parseS(Print *stream, int16_t params, int16_t p[])
+bool DCCEXParser::parseS(Print *stream, byte opcode, byte params, COMMAND_PARAM p[], byte *com, RingStream *ringStream)
 {
 
     switch (params)
@@ -727,32 +962,59 @@ bool DCCEXParser::parseS(Print *stream, int16_t params, int16_t p[])
     return false;
 }
 
-bool DCCEXParser::parseD(Print *stream, int16_t params, int16_t p[])
+bool DCCEXParser::parseD(Print *stream, int16_t params, COMMAND_PARAM p[])
 {
     if (params == 0)
         return false;
     bool onOff = (params > 0) && (p[1] == 1 || p[1] == HASH_KEYWORD_ON); // dont care if other stuff or missing... just means off
-    switch (p[0])
+    switch (keyword(p[0]))
     {
-    case HASH_KEYWORD_CABS: // <D CABS>
+    case KEYWORD_CABS: // <D CABS>
         DCC::displayCabList(stream);
         return true;
 
-    case HASH_KEYWORD_RAM: // <D RAM>
+#ifdef ENABLE_PROFILER
+    case KEYWORD_PROFILE: // <D PROFILE> <D PROFILE RESET> <D PROFILE BENCH [cab]>
+        if (p[1] == HASH_KEYWORD_RESET) Profiler::reset();
+        else if (p[1] == HASH_KEYWORD_BENCH) benchmark(stream, params > 2 ? p[2] : 3);
+        else {
+          Profiler::dump(stream);
+          dumpCommandHits(stream);
+        }
+        return true;
+#endif
+
+#ifdef ENABLE_RECORDER
+    case KEYWORD_RECORD: // <D RECORD ON|OFF|DUMP|PLAY [FAST]>
+        return CommandRecorder::command(stream, p[1], p[2]);
+#endif
+
+    case KEYWORD_SIMDECODER: // <D SIMDECODER CV|ACK|LOAD|RUN ...>
+        return SimulatedDecoder::command(stream, p[1], p[2], p[3], p[4]);
+
+    case KEYWORD_POWERLOG: // <D POWERLOG>
+        PowerLog::dump(stream);
+        return true;
+
+    case KEYWORD_RAM: // <D RAM>
         StringFormatter::send(stream, F("Free memory=%d\n"), minimumFreeMemory());
         break;
 
-    case HASH_KEYWORD_ACK: // <D ACK ON/OFF> <D ACK [LIMIT|MIN|MAX] Value>
+    case KEYWORD_ACK: // <D ACK ON/OFF> <D ACK [LIMIT|MIN|MAX] Value> <D ACK TUNE ON/OFF>
 	if (params >= 3) {
 	    if (p[1] == HASH_KEYWORD_LIMIT) {
 	      DCCWaveform::progTrack.setAckLimit(p[2]);
-	      StringFormatter::send(stream, F("Ack limit=%dmA\n"), p[2]);
+	      StringFormatter::send(stream, F("Ack limit=%dmA\n"), (int)p[2]);
 	    } else if (p[1] == HASH_KEYWORD_MIN) {
 	      DCCWaveform::progTrack.setMinAckPulseDuration(p[2]);
-	      StringFormatter::send(stream, F("Ack min=%dus\n"), p[2]);
+	      StringFormatter::send(stream, F("Ack min=%dus\n"), (int)p[2]);
 	    } else if (p[1] == HASH_KEYWORD_MAX) {
 	      DCCWaveform::progTrack.setMaxAckPulseDuration(p[2]);
-	      StringFormatter::send(stream, F("Ack max=%dus\n"), p[2]);
+	      StringFormatter::send(stream, F("Ack max=%dus\n"), (int)p[2]);
+	    } else if (p[1] == HASH_KEYWORD_TUNE) {
+	      bool tuneOn = (p[2] == 1 || p[2] == HASH_KEYWORD_ON);
+	      DCCWaveform::progTrack.setAutoTuneAckPulse(tuneOn);
+	      StringFormatter::send(stream, F("Ack tune %S\n"), tuneOn ? F("on") : F("off"));
 	    }
 	} else {
 	  StringFormatter::send(stream, F("Ack diag %S\n"), onOff ? F("on") : F("off"));
@@ -760,48 +1022,48 @@ bool DCCEXParser::parseD(Print *stream, int16_t params, int16_t p[])
 	}
         return true;
 
-    case HASH_KEYWORD_CMD: // <D CMD ON/OFF>
+    case KEYWORD_CMD: // <D CMD ON/OFF>
         Diag::CMD = onOff;
         return true;
 
-    case HASH_KEYWORD_WIFI: // <D WIFI ON/OFF>
+    case KEYWORD_WIFI: // <D WIFI ON/OFF>
         Diag::WIFI = onOff;
         return true;
 
-   case HASH_KEYWORD_ETHERNET: // <D ETHERNET ON/OFF>
+   case KEYWORD_ETHERNET: // <D ETHERNET ON/OFF>
         Diag::ETHERNET = onOff;
         return true;
 
-    case HASH_KEYWORD_WIT: // <D WIT ON/OFF>
+    case KEYWORD_WIT: // <D WIT ON/OFF>
         Diag::WITHROTTLE = onOff;
         return true;
   
-    case HASH_KEYWORD_LCN: // <D LCN ON/OFF>
+    case KEYWORD_LCN: // <D LCN ON/OFF>
         Diag::LCN = onOff;
         return true;
 
-    case HASH_KEYWORD_PROGBOOST:
+    case KEYWORD_PROGBOOST:
         DCC::setProgTrackBoost(true);
 	      return true;
 
-    case HASH_KEYWORD_RESET:
+    case KEYWORD_RESET:
         {
           wdt_enable( WDTO_15MS); // set Arduino watchdog timer for 15ms 
           delay(50);            // wait for the prescaller time to expire          
           break; // and <X> if we didnt restart 
         }
         
-    case HASH_KEYWORD_EEPROM: // <D EEPROM NumEntries>
+    case KEYWORD_EEPROM: // <D EEPROM NumEntries>
 	if (params >= 2)
 	    EEStore::dump(p[1]);
 	return true;
 
-    case HASH_KEYWORD_SPEED28:
+    case KEYWORD_SPEED28:
         DCC::setGlobalSpeedsteps(28);
 	StringFormatter::send(stream, F("28 Speedsteps"));
         return true;
 
-    case HASH_KEYWORD_SPEED128:
+    case KEYWORD_SPEED128:
         DCC::setGlobalSpeedsteps(128);
 	StringFormatter::send(stream, F("128 Speedsteps"));
         return true;
@@ -813,13 +1075,14 @@ bool DCCEXParser::parseD(Print *stream, int16_t params, int16_t p[])
 }
 
 // CALLBACKS must be static
-bool DCCEXParser::stashCallback(Print *stream, int16_t p[MAX_COMMAND_PARAMS], RingStream * ringStream)
+bool DCCEXParser::stashCallback(Print *stream, COMMAND_PARAM p[MAX_COMMAND_PARAMS], byte *com, RingStream * ringStream)
 {
     if (stashBusy )
         return false;
     stashBusy = true;
     stashStream = stream;
     stashRingStream=ringStream;
+    stashBinary = com==NULL && ringStream;
     if (ringStream) stashTarget= ringStream->peekTargetMark();
     memcpy(stashP, p, MAX_COMMAND_PARAMS * sizeof(p[0]));
     return true;
@@ -828,43 +1091,47 @@ bool DCCEXParser::stashCallback(Print *stream, int16_t p[MAX_COMMAND_PARAMS], Ri
 Print * DCCEXParser::getAsyncReplyStream() {
        if (stashRingStream) {
            stashRingStream->mark(stashTarget);
+           if (stashBinary) return BinaryProtocol::startAsyncReply(stashRingStream);
            return stashRingStream;
        }
        return stashStream;
 }
 
 void DCCEXParser::commitAsyncReplyStream() {
-     if (stashRingStream) stashRingStream->commit();
+     if (stashRingStream) {
+         if (stashBinary) BinaryProtocol::endAsyncReply(stashRingStream);
+         stashRingStream->commit();
+     }
      stashBusy = false;
 }
 
 void DCCEXParser::callback_W(int16_t result)
 {
     StringFormatter::send(getAsyncReplyStream(),
-          F("<r%d|%d|%d %d>\n"), stashP[2], stashP[3], stashP[0], result == 1 ? stashP[1] : -1);
+          F("<r%d|%d|%d %d>\n"), (int)stashP[2], (int)stashP[3], (int)stashP[0], result == 1 ? (int)stashP[1] : -1);
     commitAsyncReplyStream();
 }
 
 void DCCEXParser::callback_B(int16_t result)
 {
     StringFormatter::send(getAsyncReplyStream(), 
-          F("<r%d|%d|%d %d %d>\n"), stashP[3], stashP[4], stashP[0], stashP[1], result == 1 ? stashP[2] : -1);
+          F("<r%d|%d|%d %d %d>\n"), (int)stashP[3], (int)stashP[4], (int)stashP[0], (int)stashP[1], result == 1 ? (int)stashP[2] : -1);
     commitAsyncReplyStream();
 }
 void DCCEXParser::callback_Vbit(int16_t result)
 {
-    StringFormatter::send(getAsyncReplyStream(), F("<v %d %d %d>\n"), stashP[0], stashP[1], result);
+    StringFormatter::send(getAsyncReplyStream(), F("<v %d %d %d>\n"), (int)stashP[0], (int)stashP[1], result);
     commitAsyncReplyStream();
 }
 void DCCEXParser::callback_Vbyte(int16_t result)
 {
-    StringFormatter::send(getAsyncReplyStream(), F("<v %d %d>\n"), stashP[0], result);
+    StringFormatter::send(getAsyncReplyStream(), F("<v %d %d>\n"), (int)stashP[0], result);
     commitAsyncReplyStream();
 }
 
 void DCCEXParser::callback_R(int16_t result)
 {
-    StringFormatter::send(getAsyncReplyStream(), F("<r%d|%d|%d %d>\n"), stashP[1], stashP[2], stashP[0], result);
+    StringFormatter::send(getAsyncReplyStream(), F("<r%d|%d|%d %d>\n"), (int)stashP[1], (int)stashP[2], (int)stashP[0], result);
     commitAsyncReplyStream();
 }
 
@@ -19,11 +19,59 @@
 #ifndef DCCEXParser_h
 #define DCCEXParser_h
 #include <Arduino.h>
+#if __has_include ( "config.h")
+  #include "config.h"
+#endif
 #include "FSH.h"
 #include "RingStream.h"
 
-typedef void (*FILTER_CALLBACK)(Print * stream, byte & opcode, byte & paramCount, int16_t p[]);
-typedef void (*AT_COMMAND_CALLBACK)(const byte * command);
+// Each input source (serial, WiFi, Ethernet) keeps executing commands in one
+// loop() until it has used this many uS, then lets the rest of the loop run.
+#ifndef COMMAND_BUDGET_MICROS
+#define COMMAND_BUDGET_MICROS 2000
+#endif
+
+// Parser limits, see config.example.h. The buffers are all static so
+// raising these costs RAM on every board, the AVR defaults are the old sizes.
+#ifndef COMMAND_MAX_PARAMS
+  #if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO_ARCH_MEGAAVR)
+    #define COMMAND_MAX_PARAMS 10
+  #else
+    #define COMMAND_MAX_PARAMS 16
+  #endif
+#endif
+#ifndef COMMAND_BUFFER_SIZE
+  #if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO_ARCH_MEGAAVR)
+    #define COMMAND_BUFFER_SIZE 50
+  #else
+    #define COMMAND_BUFFER_SIZE 128
+  #endif
+#endif
+
+// A split command parameter. Keyword hashes are always 16 bit so 
+// p[n]==HASH_KEYWORD_x works in either width.
+#ifdef COMMAND_PARAMS_32BIT
+typedef int32_t COMMAND_PARAM;
+#else
+typedef int16_t COMMAND_PARAM;
+#endif
+
+typedef void (*FILTER_CALLBACK)(Print * stream, byte & opcode, byte & paramCount, COMMAND_PARAM p[]);
+
+// A command handler gets the split parameters and the command text from the opcode on,
+// or NULL for a binary command. Returning false sends <X>.
+typedef bool (*COMMAND_HANDLER)(Print * stream, byte opcode, byte params, COMMAND_PARAM p[], byte * com, RingStream * ringStream);
+
+// One row of a command table in FLASH. The first row matching both the opcode and 
+// the parameter count handles the command. A table ends with a row with opcode '\0'.
+// A row with maxParams DCCEXParser::TEXT_PARAMS reads the command text itself, so it
+// also gets commands that could not be split, with params TEXT_PARAMS.
+struct COMMAND_ENTRY {
+  byte opcode;
+  byte minParams;
+  byte maxParams;
+  COMMAND_HANDLER handler;
+};
 
 struct DCCEXParser
 {
@@ -31,37 +79,87 @@ struct DCCEXParser
    void loop(Stream & stream);
    void parse(Print * stream,  byte * command,  RingStream * ringStream);
    void parse(const FSH * cmd);
+   static bool execute(Print * stream, byte opcode, byte params, COMMAND_PARAM p[], byte * com, RingStream * ringStream);
    void flush();
+   // Filters see every command before the tables are searched, and may change it
+   // or swallow it by setting opcode '\0'. They stay for sketches and add-ons built
+   // outside this tree, such as EX-RAIL; modules in the tree use addCommands.
    static void setFilter(FILTER_CALLBACK filter);
    static void setRMFTFilter(FILTER_CALLBACK filter);
-   static void setAtCommandCallback(AT_COMMAND_CALLBACK filter);
-   static const int MAX_COMMAND_PARAMS=10;  // Must not exceed this
+   static bool addCommands(const COMMAND_ENTRY * table);  // optional modules, looked up before the built in commands
+   static const int MAX_COMMAND_PARAMS=COMMAND_MAX_PARAMS;  // Must not exceed this
+   static const byte MAX_COMMAND_TABLES=3;
+   static const byte TEXT_PARAMS=255;  // see COMMAND_ENTRY
+   static void dumpCommandHits(Print * stream);  // ENABLE_PROFILER only
+   static void benchmark(Print * stream, int16_t cab);  // ENABLE_PROFILER only
  
    private:
   
-    static const int16_t MAX_BUFFER=50;  // longest command sent in
+    static const int16_t MAX_BUFFER=COMMAND_BUFFER_SIZE;  // longest command sent in
+     static_assert(MAX_BUFFER<=255, "COMMAND_BUFFER_SIZE must fit in a byte");
      byte  bufferLength=0;
      bool  inCommandPayload=false;
+     bool  commandOverflow=false;  // dropping the rest of a command too long for buffer
      byte  buffer[MAX_BUFFER+2]; 
-    int16_t splitValues( int16_t result[MAX_COMMAND_PARAMS], const byte * command);
-    int16_t splitHexValues( int16_t result[MAX_COMMAND_PARAMS], const byte * command);
+
+    // splitValues and splitHexValues return the parameter count or one of these
+    static const int16_t TOO_MANY_PARAMS=-1;
+    static const int16_t VALUE_TOO_BIG=-2;
+    static const int16_t INVALID_HEX=-3;
+    int16_t splitValues( COMMAND_PARAM result[MAX_COMMAND_PARAMS], const byte * command);
+    static int16_t splitHexValues( COMMAND_PARAM result[MAX_COMMAND_PARAMS], const byte * command);
+    static void splitError(Print * stream, int16_t error, byte opcode);
+    static bool takesText(byte opcode);
      
-     bool parseT(Print * stream, int16_t params, int16_t p[]);
-     bool parseZ(Print * stream, int16_t params, int16_t p[]);
-     bool parseS(Print * stream,  int16_t params, int16_t p[]);
-     bool parsef(Print * stream,  int16_t params, int16_t p[]);
-     bool parseD(Print * stream,  int16_t params, int16_t p[]);
+     static int findCommand(const COMMAND_ENTRY * table, byte opcode, byte params, COMMAND_ENTRY & entry, bool & opcodeKnown);
+     static const COMMAND_ENTRY commandTable[];
+     static const COMMAND_ENTRY * commandTables[MAX_COMMAND_TABLES];
+     static byte commandTableCount;
+     static unsigned int commandHits[];  // per commandTable row, ENABLE_PROFILER only
+
+#define COMMAND_HANDLER_ARGS Print * stream, byte opcode, byte params, COMMAND_PARAM p[], byte * com, RingStream * ringStream
+     static bool parseThrottle(COMMAND_HANDLER_ARGS);
+     static bool parsef(COMMAND_HANDLER_ARGS);
+     static bool parseFunction(COMMAND_HANDLER_ARGS);
+     static bool parseAccessory(COMMAND_HANDLER_ARGS);
+     static bool parseT(COMMAND_HANDLER_ARGS);
+     static bool parseZ(COMMAND_HANDLER_ARGS);
+     static bool parseS(COMMAND_HANDLER_ARGS);
+     static bool parseWriteCVMain(COMMAND_HANDLER_ARGS);
+     static bool parseWriteCVBitMain(COMMAND_HANDLER_ARGS);
+     static bool parsePacket(COMMAND_HANDLER_ARGS);
+     static bool parseWriteLocoId(COMMAND_HANDLER_ARGS);
+     static bool parseWriteCV(COMMAND_HANDLER_ARGS);
+     static bool parseVerifyCVByte(COMMAND_HANDLER_ARGS);
+     static bool parseVerifyCVBit(COMMAND_HANDLER_ARGS);
+     static bool parseWriteCVBit(COMMAND_HANDLER_ARGS);
+     static bool parseReadLocoId(COMMAND_HANDLER_ARGS);
+     static bool parseReadCV(COMMAND_HANDLER_ARGS);
+     static bool parsePower(COMMAND_HANDLER_ARGS);
+     static bool parseEstop(COMMAND_HANDLER_ARGS);
+     static bool parseMeters(COMMAND_HANDLER_ARGS);
+     static bool parseSensorStates(COMMAND_HANDLER_ARGS);
+     static bool parseStatus(COMMAND_HANDLER_ARGS);
+     static bool parseStoreEEPROM(COMMAND_HANDLER_ARGS);
+     static bool parseClearEEPROM(COMMAND_HANDLER_ARGS);
+     static bool parseEmpty(COMMAND_HANDLER_ARGS);
+     static bool parseDiag(COMMAND_HANDLER_ARGS);
+     static bool parseLocoSlots(COMMAND_HANDLER_ARGS);
+     static bool parseForget(COMMAND_HANDLER_ARGS);
+#undef COMMAND_HANDLER_ARGS
+     static bool parseD(Print * stream,  int16_t params, COMMAND_PARAM p[]);
 
      static Print * getAsyncReplyStream();
      static void commitAsyncReplyStream();
 
     static bool stashBusy;
+    static bool stashBinary;
     static byte stashTarget;
     static Print * stashStream;
     static RingStream * stashRingStream;
     
-    static int16_t stashP[MAX_COMMAND_PARAMS];
-    bool stashCallback(Print * stream, int16_t p[MAX_COMMAND_PARAMS], RingStream * ringStream);
+    static COMMAND_PARAM stashP[MAX_COMMAND_PARAMS];
+    static bool stashCallback(Print * stream, COMMAND_PARAM p[MAX_COMMAND_PARAMS], byte * com, RingStream * ringStream);
     static void callback_W(int16_t result);
     static void callback_B(int16_t result);        
     static void callback_R(int16_t result);
@@ -71,7 +169,6 @@ struct DCCEXParser
     static void callback_Vbyte(int16_t result);
     static FILTER_CALLBACK  filterCallback;
     static FILTER_CALLBACK  filterRMFTCallback;
-    static AT_COMMAND_CALLBACK  atCommandCallback;
     static void funcmap(int16_t cab, byte value, byte fstart, byte fstop);
 
 };
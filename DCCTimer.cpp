@@ -43,11 +43,28 @@
  */
 
 #include "DCCTimer.h"
+#include "DIAG.h"
 const int DCC_SIGNAL_TIME=58;  // this is the 58uS DCC 1-bit waveform half-cycle 
 const long CLOCK_CYCLES=(F_CPU / 1000000 * DCC_SIGNAL_TIME) >>1;
 
 INTERRUPT_CALLBACK interruptHandler=0;
 
+byte ADCee::slots=0;
+byte ADCee::pins[ADCee::MAX_SLOTS];
+volatile int ADCee::samples[ADCee::MAX_SLOTS][ADCee::RING_SIZE];
+volatile byte ADCee::heads[ADCee::MAX_SLOTS];
+byte ADCee::scanSlot=0;
+
+byte ADCee::init(byte pin) {
+  if (slots>=MAX_SLOTS) return UNUSED_SLOT;
+  pins[slots]=pin;
+  // prime the ring so readers see a sensible value before the first scan
+  int value=analogRead(pin);
+  for (byte i=0;i<RING_SIZE;i++) samples[slots][i]=value;
+  heads[slots]=0;
+  return slots++;
+}
+
 #ifdef ARDUINO_ARCH_MEGAAVR
   // Arduino unoWifi Rev2 and nanoEvery architectire 
   
@@ -63,6 +80,7 @@ INTERRUPT_CALLBACK interruptHandler=0;
     TCB0.CNT = 0;
     TCB0.CTRLA |= TCB_ENABLE_bm;  // start
     interrupts();
+    ADCee::begin();
   }
 
   // ISR called by timer interrupt every 58uS
@@ -82,6 +100,12 @@ INTERRUPT_CALLBACK interruptHandler=0;
     // TODO what are the relevant pins?
  }
 
+  void DCCTimer::startCycleCount() {}
+
+  unsigned int DCCTimer::getCycleCount() {
+    return TCB0.CNT * 2;  // counts up at half the clock
+  }
+
   void   DCCTimer::getSimulatedMacAddress(byte mac[6]) {
     memcpy(mac,(void *) &SIGROW.SERNUM0,6);  // serial number
     mac[0] &= 0xFE;
@@ -95,7 +119,7 @@ INTERRUPT_CALLBACK interruptHandler=0;
     interruptHandler=callback;
 
   myDCCTimer.begin(interruptHandler, DCC_SIGNAL_TIME);
-
+  ADCee::begin();
   }
 
   bool DCCTimer::isPWMPin(byte pin) {
@@ -110,6 +134,12 @@ INTERRUPT_CALLBACK interruptHandler=0;
     (void) high;
 }
 
+  void DCCTimer::startCycleCount() {}
+
+  unsigned int DCCTimer::getCycleCount() {
+    return 0;  // not implemented
+  }
+
   void   DCCTimer::getSimulatedMacAddress(byte mac[6]) {
 #if defined(__IMXRT1062__)  //Teensy 4.0 and Teensy 4.1
     uint32_t m1 = HW_OCOTP_MAC1;
@@ -146,6 +176,29 @@ void DCCTimer::read(uint8_t word, uint8_t *mac, uint8_t offset) {
 }
 #endif
 
+#endif
+
+#if defined(ARDUINO_ARCH_MEGAAVR) || defined(TEENSYDUINO)
+  // No free running sampler here (yet), analogRead is quick enough
+  // with the sample time set up above.
+  void ADCee::begin() {}
+
+  int ADCee::read(byte slot) {
+    return analogRead(pins[slot]);
+  }
+
+  int ADCee::readAverage(byte slot) {
+    return analogRead(pins[slot]);
+  }
+
+  void ADCee::scan() {}
+
+  int ADCee::readPin(byte pin) {
+    return analogRead(pin);
+  }
+
+  void ADCee::check() {}
+
 #else 
   // Arduino nano, uno, mega etc
 #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
@@ -160,18 +213,115 @@ void DCCTimer::read(uint8_t word, uint8_t *mac, uint8_t offset) {
   void DCCTimer::begin(INTERRUPT_CALLBACK callback) {
     interruptHandler=callback;
     noInterrupts();          
-    ADCSRA = (ADCSRA & 0b11111000) | 0b00000100;   // speed up analogRead sample time 
     TCCR1A = 0;
     ICR1 = CLOCK_CYCLES;
     TCNT1 = 0;   
     TCCR1B = _BV(WGM13) | _BV(CS10);     // Mode 8, clock select 1
     TIMSK1 = _BV(TOIE1); // Enable Software interrupt
+    ADCee::begin();
     interrupts();
   }
 
 // ISR called by timer interrupt every 58uS
   ISR(TIMER1_OVF_vect){ interruptHandler(); }
 
+// Timer1 counts up from the tick to ICR1 and then back down, ICF1 is set at the top.
+  void DCCTimer::startCycleCount() {
+    TIFR1 = _BV(ICF1);  // clear by writing 1
+  }
+
+  unsigned int DCCTimer::getCycleCount() {
+    unsigned int count=TCNT1;
+    if (TIFR1 & _BV(ICF1)) count=2*CLOCK_CYCLES - count;
+    return count;
+  }
+
+// The ADC is auto triggered by the rising edge of the timer1 overflow flag, so a
+// conversion starts at every DCC interrupt. Prescale 32 gives a 500kHz ADC clock 
+// and about 26uS per conversion, well inside the 58uS. 
+// Once begin() has been called, analogRead() must not be used, see readPin().
+  static const byte ADC_SCANNING = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | 0b00000101;  // auto trigger, interrupt, prescale 32
+  static const byte ADC_TRIGGER_BITS = _BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0);
+  static void selectChannel(byte pin) {
+    byte channel= pin>=A0 ? pin-A0 : pin;
+    ADMUX = _BV(REFS0) | (channel & 0x07);  // AVcc reference
+  #ifdef MUX5
+    ADCSRB = _BV(ADTS2) | _BV(ADTS1) | ((channel & 0x08) ? _BV(MUX5) : 0);  // trigger timer1 overflow
+  #else
+    ADCSRB = _BV(ADTS2) | _BV(ADTS1);
+  #endif
+  }
+
+  void ADCee::begin() {
+    if (slots==0) return;
+    scanSlot=0;
+    selectChannel(pins[0]);
+    ADCSRA = ADC_SCANNING | _BV(ADIF);
+  }
+
+  // A pin being scanned already has a sample. Any other pin gets a conversion of its
+  // own with the scan stopped, which then starts again from the first slot.
+  int ADCee::readPin(byte pin) {
+    for (byte slot=0; slot<slots; slot++) if (pins[slot]==pin) return read(slot);
+    if (slots==0) return analogRead(pin);
+    byte sreg=SREG;
+    cli();
+    ADCSRA = ADC_SCANNING & ~(_BV(ADATE) | _BV(ADIE));
+    SREG=sreg;
+    while (ADCSRA & _BV(ADSC)) {}  // one already started
+    selectChannel(pin);
+    ADCSRA |= _BV(ADSC);
+    while (ADCSRA & _BV(ADSC)) {}
+    int value=ADCW;
+    cli();
+    begin();
+    SREG=sreg;
+    return value;
+  }
+
+  // Something else using the ADC, such as analogRead() or a library, can stop the
+  // scan and leave read() returning the same old samples for ever.
+  void ADCee::check() {
+    if (slots==0) return;
+    if ((ADCSRA & ~(_BV(ADSC) | _BV(ADIF)))==ADC_SCANNING
+        && (ADCSRB & ADC_TRIGGER_BITS)==(_BV(ADTS2) | _BV(ADTS1))) return;
+    DIAG(F("ADC changed outside ADCee, current sampling restarted"));
+    noInterrupts();
+    begin();
+    interrupts();
+  }
+
+  int ADCee::read(byte slot) {
+    byte sreg=SREG;   // may be called from interrupt() time so dont turn interrupts on
+    cli();
+    int value=samples[slot][heads[slot]];
+    SREG=sreg;
+    return value;
+  }
+
+  int ADCee::readAverage(byte slot) {
+    int sum=0;  // 8 x 1023 fits an int
+    byte sreg=SREG;
+    cli();
+    for (byte i=0;i<RING_SIZE;i++) sum+=samples[slot][i];
+    SREG=sreg;
+    return sum/RING_SIZE;
+  }
+
+  // The conversion just finished was for scanSlot, and the next one will not start
+  // before the next timer interrupt so the multiplexer can be switched now.
+  void ADCee::scan() {
+    byte slot=scanSlot;
+    byte head=(heads[slot]+1) & (RING_SIZE-1);
+    samples[slot][head]=ADCW;
+    heads[slot]=head;
+    if (++slot>=slots) slot=0;
+    scanSlot=slot;
+    selectChannel(pins[slot]);
+  }
+
+  ISR(ADC_vect){ ADCee::scan(); }
+
 // Alternative pin manipulation via PWM control.
   bool DCCTimer::isPWMPin(byte pin) {
        return pin==TIMER1_A_PIN 
@@ -30,6 +30,10 @@ class DCCTimer {
   static void getSimulatedMacAddress(byte mac[6]);
   static bool isPWMPin(byte pin);
   static void setPWM(byte pin, bool high);
+  // CPU cycles since the last timer tick, for profiling in interrupt() time.
+  // startCycleCount() must be called at the start of each interrupt.
+  static void startCycleCount();
+  static unsigned int getCycleCount();
 #if (defined(TEENSYDUINO) && !defined(__IMXRT1062__))
   static void read_mac(byte mac[6]);
   static void read(uint8_t word, uint8_t *mac, uint8_t offset);
@@ -37,4 +41,37 @@ class DCCTimer {
   private:
 };
 
+// Current sense sampling.
+// Each analog pin registered with init() gets a slot. On the AVR boards the ADC is
+// auto-triggered by the DCC timer overflow and its interrupt steps through the
+// slots, so every slot gets a fresh sample every (slots x 58uS) and read() 
+// just returns the latest one without waiting for a conversion.
+// Once begin() has run, analogRead() would upset the scan, so other analog pins
+// are read with readPin() instead. check() puts the scan back if it was changed.
+// Architectures without this fall back to analogRead().
+class ADCee {
+  public:
+  static const byte MAX_SLOTS=6;   // main, prog and 4 districts
+  static const byte RING_SIZE=8;   // power of 2
+  static const byte UNUSED_SLOT=255;
+#if defined(ARDUINO_ARCH_MEGAAVR) || defined(TEENSYDUINO)
+  static const bool SCANNING=false;  // read() is analogRead(), so it waits and is not for interrupt() time
+#else
+  static const bool SCANNING=true;
+#endif
+  static byte init(byte pin);     // before DCCTimer::begin, returns slot
+  static void begin();            // called from DCCTimer::begin
+  static int read(byte slot);     // latest sample
+  static int readAverage(byte slot);  // mean of the last RING_SIZE samples
+  static void scan();             // ADC interrupt
+  static int readPin(byte pin);   // analogRead() for any pin, not from interrupt() time
+  static void check();            // from loop()
+  private:
+  static byte slots;
+  static byte pins[MAX_SLOTS];
+  static volatile int samples[MAX_SLOTS][RING_SIZE];
+  static volatile byte heads[MAX_SLOTS];
+  static byte scanSlot;
+};
+
 #endif
@@ -24,6 +24,8 @@
 #include "DCCTimer.h"
 #include "DIAG.h"
 #include "freeMemory.h"
+#include "PowerLog.h"
+#include "Profiler.h"
 
 DCCWaveform  DCCWaveform::mainTrack(PREAMBLE_BITS_MAIN, true);
 DCCWaveform  DCCWaveform::progTrack(PREAMBLE_BITS_PROG, false);
@@ -34,18 +36,42 @@ int  DCCWaveform::progTripValue=0;
 volatile uint8_t DCCWaveform::numAckGaps=0;
 volatile uint8_t DCCWaveform::numAckSamples=0;
 uint8_t DCCWaveform::trailingEdgeCounter=0;
+byte DCCWaveform::overloadCheckNext=0;
+DCCWaveform * DCCWaveform::districts[MAX_DISTRICTS];
+byte DCCWaveform::districtCount=0;
+DCCWaveform::SIGNALPORT DCCWaveform::signalPorts[MAX_SIGNAL_PORTS];
+byte DCCWaveform::signalPortCount=0;
 
 void DCCWaveform::begin(MotorDriver * mainDriver, MotorDriver * progDriver) {
   mainTrack.motorDriver=mainDriver;
   progTrack.motorDriver=progDriver;
   progTripValue = progDriver->mA2raw(TRIP_CURRENT_PROG); // need only calculate once hence static
+  progTrack.setAckLimit(progTrack.ackLimitmA);
   mainTrack.setPowerMode(POWERMODE::OFF);      
   progTrack.setPowerMode(POWERMODE::OFF);
   // Fault pin config for odd motor boards (example pololu)
   MotorDriver::commonFaultPin = ((mainDriver->getFaultPin() == progDriver->getFaultPin())
 				 && (mainDriver->getFaultPin() != UNUSED_PIN));
   // Only use PWM if both pins are PWM capable. Otherwise JOIN does not work
+  // Districts follow the main track so they must all be able to as well.
   MotorDriver::usePWM= mainDriver->isPWMCapable() && progDriver->isPWMCapable();
+  for (byte d=0; d<districtCount; d++) 
+    if (!districts[d]->motorDriver->isPWMCapable()) MotorDriver::usePWM=false;
+  mainTrack.signalFast=mainDriver->canSetSignalFast();
+  progTrack.signalFast=progDriver->canSetSignalFast();
+  bool allFast=mainTrack.signalFast && progTrack.signalFast;
+  for (byte d=0; d<districtCount; d++) { 
+    districts[d]->signalFast=districts[d]->motorDriver->canSetSignalFast();
+    allFast &= districts[d]->signalFast;
+  }
+  // If every track can, merge their signal writes so that pins on a shared port 
+  // change together in one write, otherwise the tracks set their own.
+  signalPortCount=0;
+  if (allFast) {
+    bool fits=addSignalPorts(mainDriver,true) && addSignalPorts(progDriver,false);
+    for (byte d=0; d<districtCount; d++) fits = fits && addSignalPorts(districts[d]->motorDriver,true);
+    if (!fits) signalPortCount=0;
+  }
   if (MotorDriver::usePWM)
     DIAG(F("Signal pin config: high accuracy waveform"));
   else
@@ -53,20 +79,101 @@ void DCCWaveform::begin(MotorDriver * mainDriver, MotorDriver * progDriver) {
   DCCTimer::begin(DCCWaveform::interruptHandler);     
 }
 
+bool DCCWaveform::addSignalPorts(MotorDriver * driver, bool main) {
+  for (byte w=0; w<driver->getSignalWrites(); w++) {
+    const SIGNALWRITE & write=driver->getSignalWrite(w);
+    byte p=0;
+    while (p<signalPortCount && signalPorts[p].port!=write.port) p++;
+    if (p==signalPortCount) {
+      if (signalPortCount==MAX_SIGNAL_PORTS) return false;
+      signalPorts[p]={write.port, (PORTREG)~0, 0, 0, 0, 0};
+      signalPortCount++;
+    }
+    SIGNALPORT & port=signalPorts[p];
+    port.keep &= write.keep;
+    if (main) {
+      port.mainHigh |= write.highBits;
+      port.mainLow |= write.lowBits;
+    }
+    else {
+      port.progHigh |= write.highBits;
+      port.progLow |= write.lowBits;
+    }
+  }
+  return true;
+}
+
+bool DCCWaveform::addDistrict(MotorDriver * driver) {
+  if (districtCount>=MAX_DISTRICTS) {
+    DIAG(F("Too many districts"));
+    return false;
+  }
+  DCCWaveform * district=new DCCWaveform(PREAMBLE_BITS_MAIN, true);
+  district->districtNumber=districtCount+1;
+  district->motorDriver=driver;
+  district->setPowerMode(POWERMODE::OFF);
+  districts[districtCount++]=district;
+  return true;
+}
+
+DCCWaveform * DCCWaveform::getDistrict(int district) {
+  if (district<1 || district>districtCount) return NULL;
+  return districts[district-1];
+}
+
+void DCCWaveform::setDistrictsPowerMode(POWERMODE mode) {
+  for (byte d=0; d<districtCount; d++) districts[d]->setPowerMode(mode);
+}
+
 void DCCWaveform::loop(bool ackManagerActive) {
+  ADCee::check();  // the overload checks below depend on fresh samples
+  if (!ADCee::SCANNING) {
+    mainTrack.sampleCurrent();
+    progTrack.sampleCurrent();
+    for (byte d=0; d<districtCount; d++) districts[d]->sampleCurrent();
+  }
   mainTrack.checkPowerOverload(false);
   progTrack.checkPowerOverload(ackManagerActive);
+  for (byte d=0; d<districtCount; d++) districts[d]->checkPowerOverload(false);
+  mainTrack.collectMeter();
+  progTrack.collectMeter();
+  for (byte d=0; d<districtCount; d++) districts[d]->collectMeter();
+}
+
+const FSH * DCCWaveform::trackName() {
+  switch (districtNumber) {
+    case 0: return isMainTrack ? F("MAIN") : F("PROG");
+    case 1: return F("DISTRICT 1");
+    case 2: return F("DISTRICT 2");
+    case 3: return F("DISTRICT 3");
+    default: return F("DISTRICT 4");
+  }
+}
+
+char DCCWaveform::trackCode() {
+  if (districtNumber) return '0'+districtNumber;
+  return isMainTrack ? 'M' : 'P';
 }
 
 void DCCWaveform::interruptHandler() {
+  PROFILE_TICK_START();
   // call the timer edge sensitive actions for progtrack and maintrack
   // member functions would be cleaner but have more overhead
   byte sigMain=signalTransform[mainTrack.state];
   byte sigProg=progTrackSyncMain? sigMain : signalTransform[progTrack.state];
   
-  // Set the signal state for both tracks
-  mainTrack.motorDriver->setSignal(sigMain);
-  progTrack.motorDriver->setSignal(sigProg);
+  // Set the signal state for both tracks and all the districts
+  if (signalPortCount) {
+    for (byte p=0; p<signalPortCount; p++) {
+      SIGNALPORT & port=signalPorts[p];
+      *port.port = (*port.port & port.keep) | (sigMain ? port.mainHigh : port.mainLow) | (sigProg ? port.progHigh : port.progLow);
+    }
+  }
+  else {
+    mainTrack.setSignal(sigMain);
+    progTrack.setSignal(sigProg);
+    for (byte d=0; d<districtCount; d++) districts[d]->setSignal(sigMain);
+  }
   
   // Move on in the state engine
   mainTrack.state=stateTransform[mainTrack.state];    
@@ -74,10 +181,31 @@ void DCCWaveform::interruptHandler() {
 
 
   // WAVE_PENDING means we dont yet know what the next bit is
+#ifdef ENABLE_PROFILER
+  bool newBit=mainTrack.state==WAVE_PENDING || progTrack.state==WAVE_PENDING;
+#endif
   if (mainTrack.state==WAVE_PENDING) mainTrack.interrupt2();  
   if (progTrack.state==WAVE_PENDING) progTrack.interrupt2();
-  else if (progTrack.ackPending) progTrack.checkAck();
+  else if (progTrack.ackPending) {
+    PROFILE_CYCLES_START(ackStart);
+    progTrack.checkAck();
+    PROFILE_CYCLES_END(ackStart, PROFILE_CHECKACK);
+  }
+  else if (progTrack.ackBaselineTracking) progTrack.trackAckBaseline();
+
+  // The current pins are sampled in turn, one per interrupt, so look at one track each time.
+  // Without the ADC scan a read waits for a conversion, so loop() samples instead.
+  if (ADCee::SCANNING) {
+    if (overloadCheckNext==0) mainTrack.sampleCurrent();
+    else if (overloadCheckNext==1) progTrack.sampleCurrent();
+    else districts[overloadCheckNext-2]->sampleCurrent();
+    if (++overloadCheckNext >= districtCount+2) overloadCheckNext=0;
+  }
 
+#ifdef ENABLE_PROFILER
+  if (newBit) PROFILE_TICK_END(PROFILE_ISR_BIT);
+  PROFILE_TICK_END(PROFILE_ISR);
+#endif
 }
 
 
@@ -111,26 +239,79 @@ POWERMODE DCCWaveform::getPowerMode() {
 }
 
 void DCCWaveform::setPowerMode(POWERMODE mode) {
+  noInterrupts();
+  overloadHeat=0;
+  overloadTripped=false;
   powerMode = mode;
+  interrupts();
   bool ison = (mode == POWERMODE::ON);
   motorDriver->setPower( ison);
 }
 
+void DCCWaveform::setOverloadLimit(int tripValue) {
+  byte tracks= ADCee::SCANNING ? districtCount+2 : 2;  // sampled in turn, see OVERLOAD_BUDGET
+  if (tripValue==overloadLimit && tracks==overloadTracks) return;
+  int limit=tripValue;
+  if (tripValue>1024) tripValue=1024;  // the ADC cant read any higher, and keeps the budget inside a long
+  long squared=(long)tripValue*tripValue;
+  long budget=squared*OVERLOAD_BUDGET*2/tracks;
+  noInterrupts();
+  overloadLimit=limit;   // the interrupt reads it too, and an int is two bytes on AVR
+  overloadLimitSquared=squared;
+  overloadBudget=budget;
+  interrupts();
+  overloadTracks=tracks;
+}
+
+void DCCWaveform::sampleCurrent() {
+  // This function operates in interrupt() time (when ADCee::SCANNING) so must be fast and can't DIAG 
+  if (powerMode!=POWERMODE::ON) return;
+  int current=motorDriver->getCurrentRaw();
+  if (current<0) return;  // fault pin, checkPowerOverload deals with that
+  long square=(long)current*current;
+
+  if (meterCount<METER_MAX_SAMPLES) {
+    meterCount++;
+    meterSum+=current;
+    meterSumSquares+=square;
+    if (current<meterMin) meterMin=current;
+    if (current>meterMax) meterMax=current;
+  }
+
+  // Fast overload trip
+  if (overloadTripped || overloadLimit==0) return;
+  overloadHeat+=square - overloadLimitSquared;
+  if (overloadHeat<=0) {
+    overloadHeat=0;
+    return;
+  }
+  if (overloadHeat<overloadBudget) return;
+  // Power off now, checkPowerOverload does the rest when it next looks
+  motorDriver->setPower(false);
+  overloadTripCurrent=current;
+  overloadTripped=true;
+}
+
 
 void DCCWaveform::checkPowerOverload(bool ackManagerActive) {
-  if (millis() - lastSampleTaken  < sampleDelay) return;
-  lastSampleTaken = millis();
   int tripValue= motorDriver->getRawCurrentTripValue();
   if (!isMainTrack && !ackManagerActive && !progTrackSyncMain && !progTrackBoosted)
     tripValue=progTripValue;
+  setOverloadLimit(tripValue);
+
+  // A fast trip has already cut the power, so dont wait for the next sample time
+  bool tripped=overloadTripped;
+  if (!tripped && millis() - lastSampleTaken  < sampleDelay) return;
+  lastSampleTaken = millis();
   
   switch (powerMode) {
     case POWERMODE::OFF:
       sampleDelay = POWER_SAMPLE_OFF_WAIT;
       break;
     case POWERMODE::ON:
-      // Check current
-      lastCurrent=motorDriver->getCurrentRaw();
+      // Check current, averaged over the last millisecond or so of samples
+      if (tripped) lastCurrent=overloadTripCurrent;
+      else lastCurrent=motorDriver->getCurrentRaw(true);
       if (lastCurrent < 0) {
 	  // We have a fault pin condition to take care of
 	  lastCurrent = -lastCurrent;
@@ -141,15 +322,17 @@ void DCCWaveform::checkPowerOverload(bool ackManagerActive) {
 	      }
 	      // Write this after the fact as we want to turn on as fast as possible
 	      // because we don't know which output actually triggered the fault pin
-	      DIAG(F("*** COMMON FAULT PIN ACTIVE - TOGGLED POWER on %S ***"), isMainTrack ? F("MAIN") : F("PROG"));
+	      PowerLog::record(POWEREVENT::COMMON_FAULT, trackCode(), motorDriver->raw2mA(lastCurrent), motorDriver->raw2mA(tripValue), 0);
+	      DIAG(F("*** COMMON FAULT PIN ACTIVE - TOGGLED POWER on %S ***"), trackName());
 	  } else {
-	      DIAG(F("*** %S FAULT PIN ACTIVE - OVERLOAD ***"), isMainTrack ? F("MAIN") : F("PROG"));
+	      PowerLog::record(POWEREVENT::FAULT, trackCode(), motorDriver->raw2mA(lastCurrent), motorDriver->raw2mA(tripValue), 0);
+	      DIAG(F("*** %S FAULT PIN ACTIVE - OVERLOAD ***"), trackName());
 	      if (lastCurrent < tripValue) {
 		  lastCurrent = tripValue; // exaggerate
 	      }
 	  }
       }
-      if (lastCurrent < tripValue) {
+      if (!tripped && lastCurrent < tripValue) {
         sampleDelay = POWER_SAMPLE_ON_WAIT;
 	if(power_good_counter<100)
 	  power_good_counter++;
@@ -161,7 +344,8 @@ void DCCWaveform::checkPowerOverload(bool ackManagerActive) {
         unsigned int maxmA=motorDriver->raw2mA(tripValue);
 	power_good_counter=0;
         sampleDelay = power_sample_overload_wait;
-        DIAG(F("*** %S TRACK POWER OVERLOAD current=%d max=%d  offtime=%d ***"), isMainTrack ? F("MAIN") : F("PROG"), mA, maxmA, sampleDelay);
+        PowerLog::record(tripped ? POWEREVENT::FAST_TRIP : POWEREVENT::OVERLOAD, trackCode(), mA, maxmA, sampleDelay);
+        DIAG(F("*** %S TRACK POWER OVERLOAD current=%d max=%d  offtime=%d ***"), trackName(), mA, maxmA, sampleDelay);
 	if (power_sample_overload_wait >= 10000)
 	    power_sample_overload_wait = 10000;
 	else
@@ -172,13 +356,84 @@ void DCCWaveform::checkPowerOverload(bool ackManagerActive) {
       // Try setting it back on after the OVERLOAD_WAIT
       setPowerMode(POWERMODE::ON);
       sampleDelay = POWER_SAMPLE_ON_WAIT;
+      PowerLog::record(POWEREVENT::RESET, trackCode(), 0, motorDriver->raw2mA(tripValue), power_sample_overload_wait);
       // Debug code....
-      DIAG(F("*** %S TRACK POWER RESET delay=%d ***"), isMainTrack ? F("MAIN") : F("PROG"), sampleDelay);
+      DIAG(F("*** %S TRACK POWER RESET delay=%d ***"), trackName(), sampleDelay);
       break;
     default:
       sampleDelay = 999; // cant get here..meaningless statement to avoid compiler warning.
   }
 }
+
+void DCCWaveform::collectMeter() {
+  unsigned long now=millis();
+  if (now - lastMeterCollect < METER_COLLECT_WAIT) return;
+  lastMeterCollect=now;
+
+  noInterrupts();
+  unsigned long sum=meterSum;
+  unsigned long sumSquares=meterSumSquares;
+  unsigned int count=meterCount;
+  int minimum=meterMin;
+  int maximum=meterMax;
+  meterSum=0;
+  meterSumSquares=0;
+  meterCount=0;
+  meterMin=0x7FFF;
+  meterMax=0;
+  interrupts();
+
+  if (count>0) {
+    shortBlock.sum+=sum;
+    shortBlock.sumSquares+=sumSquares;
+    shortBlock.count+=count;
+    if (minimum<shortBlock.minimum) shortBlock.minimum=minimum;
+    if (maximum>shortBlock.maximum) shortBlock.maximum=maximum;
+    longBlock.sum+=sum;
+    longBlock.sumSquares+=sumSquares;
+    longBlock.count+=count;
+    if (minimum<longBlock.minimum) longBlock.minimum=minimum;
+    if (maximum>longBlock.maximum) longBlock.maximum=maximum;
+  }
+  if (now - windowStart < METER_WINDOW) return;
+  windowStart=now;
+  closeBlock(shortBlock, shortStats);
+  if (++longWindows<METER_LONG_WINDOWS) return;
+  longWindows=0;
+  closeBlock(longBlock, longStats);
+}
+
+// Square root of a mean square of raw samples, which is at most 1023*1023
+static int rootMeanSquare(uint64_t sumSquares, unsigned long count) {
+  unsigned long meanSquare=sumSquares/count;
+  unsigned long root=0;
+  for (unsigned long bit=1UL<<10; bit; bit>>=1) {
+    unsigned long trial=root|bit;
+    if (trial*trial<=meanSquare) root=trial;
+  }
+  return root;
+}
+
+void DCCWaveform::clearBlock(MeterBlock & block) {
+  block.sum=0;
+  block.sumSquares=0;
+  block.count=0;
+  block.minimum=0x7FFF;
+  block.maximum=0;
+}
+
+// Converts a block to mA and starts it again, all zero if the power was off throughout
+void DCCWaveform::closeBlock(MeterBlock & block, CurrentStats & stats) {
+  if (block.count>0) {
+    stats.minimum=motorDriver->raw2mA(block.minimum);
+    stats.maximum=motorDriver->raw2mA(block.maximum);
+    stats.average=motorDriver->raw2mA(block.sum/block.count);
+    stats.rms=motorDriver->raw2mA(rootMeanSquare(block.sumSquares, block.count));
+  }
+  else stats={0,0,0,0};
+  clearBlock(block);
+}
+
 // For each state of the wave  nextState=stateTransform[currentState] 
 const WAVE_STATE DCCWaveform::stateTransform[]={
    /* WAVE_START   -> */ WAVE_PENDING,
@@ -241,6 +496,23 @@ void DCCWaveform::interrupt2() {
         transmitRepeats = pendingRepeats;
         packetPending = false;
         sentResetsSincePacket=0;
+        if (isMainTrack) PROFILE_PACKET_STARTED();
+      }
+      else if (reminderCount>0) {
+        // Nothing pending so send the next speed reminder rather than an idle
+        if (reminderNext>=reminderCount) reminderNext=0;
+        const byte * reminder=reminders[reminderNext++];
+        // length from the packet: long address, then 128 step speed or 28 step instruction
+        byte length= (reminder[0] & 0xC0)==0xC0 ? 2 : 1;
+        length+= reminder[length]==0x3F ? 2 : 1;
+        byte checksum=0;
+        for (byte b=0; b<length; b++) {
+          checksum^=reminder[b];
+          transmitPacket[b]=reminder[b];
+        }
+        transmitPacket[length]=checksum;
+        transmitLength=length+1;
+        transmitRepeats=0;
       }
       else {
         // Fortunately reset and idle packets are the same length
@@ -269,29 +541,66 @@ void DCCWaveform::schedulePacket(const byte buffer[], byte byteCount, byte repea
   pendingPacket[byteCount] = checksum;
   pendingLength = byteCount + 1;
   pendingRepeats = repeats;
+  if (isMainTrack) PROFILE_PACKET_SCHEDULED();
   packetPending = true;
   sentResetsSincePacket=0;
 }
 
+void DCCWaveform::setReminders(const byte (*packets)[4], byte count) {
+  noInterrupts();
+  reminders=packets;
+  reminderCount=count;
+  interrupts();
+}
+
 // Operations applicable to PROG track ONLY.
 // (yes I know I could have subclassed the main track but...) 
 
 void DCCWaveform::setAckBaseline() {
       if (isMainTrack) return;
       int baseline=motorDriver->getCurrentRaw();
-      ackThreshold= baseline + motorDriver->mA2raw(ackLimitmA);
-      if (Diag::ACK) DIAG(F("ACK baseline=%d/%dmA Threshold=%d/%dmA Duration between %dus and %dus"),
-			  baseline,motorDriver->raw2mA(baseline),
-			  ackThreshold,motorDriver->raw2mA(ackThreshold),
-                          minAckPulseDuration, maxAckPulseDuration);
+      if (baseline<0) baseline=0;  // fault pin, let tracking sort it out
+      // Seed the running averages, the interrupt keeps them up to date
+      // from the reset packets sent before each programming packet.
+      noInterrupts();
+      ackBaselineAverage=baseline<<ACK_EWMA_SHIFT;
+      ackNoiseAverage=0;
+      ackBaselineTracking=true;
+      interrupts();
+      if (Diag::ACK) DIAG(F("ACK baseline=%d/%dmA Limit=%dmA Duration between %dus and %dus%S"),
+			  baseline,motorDriver->raw2mA(baseline), ackLimitmA,
+                          minAckPulseDuration, maxAckPulseDuration,
+                          autoTuneAckPulse ? F(" (tuning)") : F(""));
 }
 
 void DCCWaveform::setAckPending() {
       if (isMainTrack) return; 
+      noInterrupts();
+      int baseline=ackBaselineAverage >> ACK_EWMA_SHIFT;
+      int margin=ackNoiseAverage >> (ACK_EWMA_SHIFT-ACK_NOISE_FACTOR_SHIFT);
+      interrupts();
+      // The threshold sits above the tracked baseline by a multiple of the observed
+      // noise, but never more than the configured limit or less than half of it.
+      int limit=ackLimitRaw;
+      if (margin>limit) margin=limit;
+      else if (margin<limit/2) margin=limit/2;
+      ackThreshold=baseline+margin;
+
+      ackWindowMin=minAckPulseDuration;
+      ackWindowMax=maxAckPulseDuration;
+      if (autoTuneAckPulse && ackPulseAverage>0) {
+        // only ever widen the window around what this decoder really sends 
+        unsigned int tunedMin=ackPulseAverage - ackPulseAverage/3;
+        unsigned int tunedMax=ackPulseAverage + ackPulseAverage/2;
+        if (tunedMin<ackWindowMin) ackWindowMin=tunedMin;
+        if (tunedMax>ackWindowMax) ackWindowMax=tunedMax;
+      }
+      
       ackMaxCurrent=0;
       ackPulseStart=0;
       ackPulseDuration=0;
       ackDetected=false;
+      ackUnsentRepeats=0;
       ackCheckStart=millis();
       numAckSamples=0;
       numAckGaps=0;
@@ -300,12 +609,33 @@ void DCCWaveform::setAckPending() {
 
 byte DCCWaveform::getAck() {
       if (ackPending) return (2);  // still waiting
-      if (Diag::ACK) DIAG(F("%S after %dmS max=%d/%dmA pulse=%duS samples=%d gaps=%d"),ackDetected?F("ACK"):F("NO-ACK"), ackCheckDuration,
-			  ackMaxCurrent,motorDriver->raw2mA(ackMaxCurrent), ackPulseDuration, numAckSamples, numAckGaps);
-      if (ackDetected) return (1); // Yes we had an ack
+      if (Diag::ACK) DIAG(F("%S after %dmS max=%d/%dmA threshold=%d/%dmA pulse=%duS samples=%d gaps=%d"),ackDetected?F("ACK"):F("NO-ACK"), ackCheckDuration,
+			  ackMaxCurrent,motorDriver->raw2mA(ackMaxCurrent), ackThreshold, motorDriver->raw2mA(ackThreshold),
+			  ackPulseDuration, numAckSamples, numAckGaps);
+      if (ackDetected) {
+        if (autoTuneAckPulse) {
+          if (ackPulseAverage==0) ackPulseAverage=ackPulseDuration;
+          else ackPulseAverage += ((long)ackPulseDuration - (long)ackPulseAverage)/4;
+        }
+        return (1); // Yes we had an ack
+      }
       return(0);  // pending set off but not detected means no ACK.   
 }
 
+void DCCWaveform::trackAckBaseline() {
+    // This function operates in interrupt() time so must be fast and can't DIAG 
+    // Only sample during idle resets so that programming packets and any
+    // late ACK tail do not drag the baseline up.
+    if (sentResetsSincePacket < 2) return;
+    int current=motorDriver->getCurrentRaw();
+    if (current<0) return;  // fault pin active
+    int baseline=ackBaselineAverage >> ACK_EWMA_SHIFT;
+    int deviation=current-baseline;
+    ackBaselineAverage+=deviation;
+    if (deviation<0) deviation=-deviation;
+    ackNoiseAverage+=deviation - (ackNoiseAverage >> ACK_EWMA_SHIFT);
+}
+
 void DCCWaveform::checkAck() {
     // This function operates in interrupt() time so must be fast and can't DIAG 
     if (sentResetsSincePacket > 6) {  //ACK timeout
@@ -346,10 +676,12 @@ void DCCWaveform::checkAck() {
     }
     trailingEdgeCounter = 0;
 
-    if (ackPulseDuration>=minAckPulseDuration && ackPulseDuration<=maxAckPulseDuration) {
+    if (ackPulseDuration>=ackWindowMin && ackPulseDuration<=ackWindowMax) {
         ackCheckDuration=millis()-ackCheckStart;
         ackDetected=true;
         ackPending=false;
+        // still sending the packet if no resets yet, remember how much was saved
+        if (sentResetsSincePacket==0) ackUnsentRepeats=transmitRepeats;
         transmitRepeats=0;  // shortcut remaining repeat packets 
         return;  // we have a genuine ACK result
     }      
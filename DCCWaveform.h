@@ -27,11 +27,51 @@ const int  POWER_SAMPLE_ON_WAIT = 100;
 const int  POWER_SAMPLE_OFF_WAIT = 1000;
 const int  POWER_SAMPLE_OVERLOAD_WAIT = 20;
 
+// Fast overload trip. The interrupt integrates (current^2 - trip^2) for each track
+// at every sample and cuts the power when the total reaches OVERLOAD_BUDGET x trip^2.
+// With only main and prog the samples are 116uS apart, so 1.5x the trip current
+// (about where a standard shield's sense input saturates) trips in 1.5mS, while
+// 1.1x lasts nearly 9mS so inrush is ridden through. Each district adds 58uS to
+// the time between samples, so the budget is scaled by 2/(districts+2) to keep
+// about the same trip times. Boards without the ADCee scan (MEGAAVR, Teensy)
+// sample once per loop() instead, so there the trip time follows the loop.
+// The periodic check still catches slow overloads.
+const long OVERLOAD_BUDGET = 16;
+
+// Current meters. The interrupt adds up the samples it checks, the loop collects
+// them every METER_COLLECT_WAIT into a 1 second block and a 10 second block.
+// These are fixed blocks, not rolling windows, each replacing the last one when
+// it closes, which saves keeping per second history for every track. Both are
+// worked out from the samples themselves, in integers. METER_MAX_SAMPLES keeps
+// the interrupt's sum of squares inside an unsigned long if the loop is held up.
+const int  METER_COLLECT_WAIT = 50;
+const int  METER_WINDOW = 1000;
+const byte METER_LONG_WINDOWS = 10;
+const unsigned int METER_MAX_SAMPLES = 4096;
+
+struct CurrentStats {  // milliamps
+  int minimum;
+  int maximum;
+  int average;
+  int rms;
+};
+
 // Number of preamble bits.
 const int   PREAMBLE_BITS_MAIN = 16;
 const int   PREAMBLE_BITS_PROG = 22;
 const byte   MAX_PACKET_SIZE = 5;  // NMRA standard extended packets, payload size WITHOUT checksum.
 
+// Extra power districts, each with its own motor driver carrying the main track signal
+const byte  MAX_DISTRICTS = 4;
+
+// Ports that the signal pins of all tracks may be spread over for the combined write
+const byte  MAX_SIGNAL_PORTS = 6;
+
+// ACK baseline tracking. The baseline and noise averages are exponentially
+// weighted over 2^ACK_EWMA_SHIFT samples and held scaled by that factor
+// (1023<<5 still fits in an int).
+const byte  ACK_EWMA_SHIFT = 5;
+
 // The WAVE_STATE enum is deliberately numbered because a change of order would be catastrophic
 // to the transform array.
 enum  WAVE_STATE : byte {WAVE_START=0,WAVE_MID_1=1,WAVE_HIGH_0=2,WAVE_MID_0=3,WAVE_LOW_0=4,WAVE_PENDING=5};
@@ -53,6 +93,12 @@ class DCCWaveform {
     static void loop(bool ackManagerActive);
     static DCCWaveform  mainTrack;
     static DCCWaveform  progTrack;
+    static bool addDistrict(MotorDriver * driver);  // before begin()
+    static DCCWaveform * getDistrict(int district);  // 1..getDistrictCount(), NULL if no such district
+    static inline byte getDistrictCount() {
+      return districtCount;
+    }
+    static void setDistrictsPowerMode(POWERMODE mode);
 
     void beginTrack();
     void setPowerMode(POWERMODE);
@@ -68,6 +114,9 @@ class DCCWaveform {
         return motorDriver->raw2mA(lastCurrent);
       return 0;
     }
+    inline const CurrentStats & getStats(bool longWindow) {
+      return longWindow ? longStats : shortStats;
+    }
     inline int getMaxmA() {
       if (maxmA == 0) { //only calculate this for first request, it doesn't change
         maxmA = motorDriver->raw2mA(motorDriver->getRawCurrentTripValue()); //TODO: replace with actual max value or calc
@@ -81,12 +130,19 @@ class DCCWaveform {
       return tripmA;        
     }
     void schedulePacket(const byte buffer[], byte byteCount, byte repeats);
+    void setReminders(const byte (*packets)[4], byte count);  // main track only
     volatile bool packetPending;
     volatile byte sentResetsSincePacket;
     volatile bool autoPowerOff=false;
-    void setAckBaseline();  //prog track only
+    void setAckBaseline();  //prog track only, starts baseline tracking
     void setAckPending();  //prog track only
     byte getAck();               //prog track only 0=NACK, 1=ACK 2=keep waiting
+    inline byte getAckUnsentRepeats() {  //prog track only, repeats cut short by the last ACK
+      return ackUnsentRepeats;
+    }
+    inline void stopAckBaseline() {  //prog track only
+      ackBaselineTracking=false;
+    }
     static bool progTrackSyncMain;  // true when prog track is a siding switched to main
     static bool progTrackBoosted;   // true when prog track is not current limited
     inline void doAutoPowerOff() {
@@ -100,6 +156,7 @@ class DCCWaveform {
     };
     inline void setAckLimit(int mA) {
 	ackLimitmA = mA;
+	ackLimitRaw = motorDriver->mA2raw(mA);
     }
     inline void setMinAckPulseDuration(unsigned int i) {
 	minAckPulseDuration = i;
@@ -107,6 +164,10 @@ class DCCWaveform {
     inline void setMaxAckPulseDuration(unsigned int i) {
 	maxAckPulseDuration = i;
     }
+    inline void setAutoTuneAckPulse(bool on) {
+	autoTuneAckPulse = on;
+	ackPulseAverage = 0;
+    }
 
   private:
     
@@ -117,11 +178,39 @@ class DCCWaveform {
    static const bool signalTransform[6];
   
     static void interruptHandler();
+    const FSH * trackName();
+    char trackCode();
     void interrupt2();
     void checkAck();
+    void trackAckBaseline();
+    void sampleCurrent();
+    void collectMeter();
+    void setOverloadLimit(int tripValue);
     
+    static DCCWaveform * districts[MAX_DISTRICTS];
+    static byte districtCount;
+
+    // All the signal pins on a port set in a single write, districts follow main
+    struct SIGNALPORT {
+      volatile PORTREG *port;
+      PORTREG keep;
+      PORTREG mainHigh;
+      PORTREG mainLow;
+      PORTREG progHigh;
+      PORTREG progLow;
+    };
+    static SIGNALPORT signalPorts[MAX_SIGNAL_PORTS];
+    static byte signalPortCount;    // 0 if the tracks set their own signals
+    static bool addSignalPorts(MotorDriver * driver, bool main);
+
     bool isMainTrack;
+    byte districtNumber=0;    // 0 for the main and prog tracks
     MotorDriver*  motorDriver;
+    bool signalFast;          // motorDriver->canSetSignalFast(), decided in begin()
+    inline void setSignal(bool high) {
+      if (signalFast) motorDriver->setSignalFast(high);
+      else motorDriver->setSignal(high);
+    }
     // Transmission controller
     byte transmitPacket[MAX_PACKET_SIZE+1]; // +1 for checksum
     byte transmitLength;
@@ -134,6 +223,10 @@ class DCCWaveform {
     byte pendingPacket[MAX_PACKET_SIZE+1]; // +1 for checksum
     byte pendingLength;
     byte pendingRepeats;
+    // Speed packets sent in turn instead of idles, see DCC::publishReminders
+    const byte (*reminders)[4]=NULL;
+    byte reminderCount=0;
+    byte reminderNext=0;
     int  lastCurrent;
     static int progTripValue;
     int maxmA;
@@ -149,11 +242,47 @@ class DCCWaveform {
     unsigned long power_sample_overload_wait = POWER_SAMPLE_OVERLOAD_WAIT;
     unsigned int power_good_counter = 0;
 
+    // fast overload trip, integrated in interrupt() time
+    static byte overloadCheckNext;  // which track the interrupt checks next, main, prog then districts
+    int  overloadLimit=0;           // raw trip value and number of tracks sampled in turn
+    byte overloadTracks=0;          // that the two below were calculated for
+    long overloadLimitSquared;
+    long overloadBudget;
+    long overloadHeat=0;
+    volatile bool overloadTripped=false;
+    int  overloadTripCurrent;
+
+    // current meters, raw values added up in interrupt() time
+    unsigned long meterSum=0;
+    unsigned long meterSumSquares=0;
+    unsigned int  meterCount=0;
+    int meterMin=0x7FFF;
+    int meterMax=0;
+    // collected by the loop into the open 1 and 10 second blocks
+    struct MeterBlock {
+      unsigned long sum;
+      uint64_t sumSquares;
+      unsigned long count;
+      int minimum;
+      int maximum;
+    };
+    static void clearBlock(MeterBlock & block);
+    void closeBlock(MeterBlock & block, CurrentStats & stats);
+    unsigned long lastMeterCollect=0;
+    unsigned long windowStart=0;
+    MeterBlock shortBlock={0,0,0,0x7FFF,0};
+    byte longWindows=0;  // 1 second blocks in the open 10 second one
+    MeterBlock longBlock={0,0,0,0x7FFF,0};
+    CurrentStats shortStats={0,0,0,0};
+    CurrentStats longStats={0,0,0,0};
+
     // ACK management (Prog track only)  
     volatile bool ackPending;
     volatile bool ackDetected;
+    byte ackUnsentRepeats;
     int  ackThreshold; 
     int  ackLimitmA = 60;
+    int  ackLimitRaw;
     int ackMaxCurrent;
     unsigned long ackCheckStart; // millis
     unsigned int ackCheckDuration; // millis       
@@ -163,6 +292,15 @@ class DCCWaveform {
 
     unsigned int minAckPulseDuration = 4000; // micros
     unsigned int maxAckPulseDuration = 8500; // micros
+    unsigned int ackWindowMin;  // micros, pulse window in use for this ACK
+    unsigned int ackWindowMax;  // micros
+
+    volatile bool ackBaselineTracking=false;
+    int ackBaselineAverage;  // EWMA of current during resets, scaled
+    int ackNoiseAverage;     // EWMA of deviation from baseline, scaled
+    bool autoTuneAckPulse=false;
+    unsigned int ackPulseAverage=0;  // micros, average of accepted ACK pulses
+    static const byte ACK_NOISE_FACTOR_SHIFT = 2;  // threshold margin is 4x mean noise
 
     volatile static uint8_t numAckGaps;
     volatile static uint8_t numAckSamples;
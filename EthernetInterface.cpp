@@ -28,6 +28,8 @@
 #include "EthernetInterface.h"
 #include "DIAG.h"
 #include "CommandDistributor.h"
+#include "CommandRecorder.h"
+#include "CurrentMeters.h"
 #include "DCCTimer.h"
 
 EthernetInterface * EthernetInterface::singleton=NULL;
@@ -145,30 +147,55 @@ void EthernetInterface::loop()
                 // so we store it in our client array
                 if (Diag::ETHERNET) DIAG(F("Socket %d"),socket);
                 clients[socket] = client;
+                framers[socket].reset();
+                CurrentMeters::unsubscribe(outboundRing, socket);
                 break;
             }
         }
         if (socket==MAX_SOCK_NUM) DIAG(F("new Ethernet OVERFLOW")); 
     }
 
-    // check for incoming data from all possible clients
-    for (byte socket = 0; socket < MAX_SOCK_NUM; socket++)
+    // check for incoming data from all possible clients, one read each in turn 
+    // starting after the last one served, until the command budget is spent
+    unsigned long startTime=micros();
+    bool busy=true;
+    while (busy && micros()-startTime < COMMAND_BUDGET_MICROS && outboundRing->freeSpace() >= MIN_ETH_REPLY_SPACE)
     {
-        if (clients[socket]) {
-        
-        int available=clients[socket].available();
-        if (available > 0) {
-            if (Diag::ETHERNET)  DIAG(F("Ethernet: available socket=%d,avail=%d"), socket, available);
-            // read bytes from a client
-            int count = clients[socket].read(buffer, MAX_ETH_BUFFER);
-            buffer[count] = '\0'; // terminate the string properly
-            if (Diag::ETHERNET) DIAG(F(",count=%d:%e"), socket,buffer);
-            // execute with data going directly back
-            outboundRing->mark(socket); 
-            CommandDistributor::parse(socket,buffer,outboundRing);
-            outboundRing->commit();
-            return; // limit the amount of processing that takes place within 1 loop() cycle. 
-          }
+        busy=false;
+        for (byte turn = 0; turn < MAX_SOCK_NUM; turn++)
+        {
+            byte socket=nextSocket;
+            nextSocket=(nextSocket+1) % MAX_SOCK_NUM;
+            if (!clients[socket]) continue;
+            
+            int available=clients[socket].available();
+            if (available > 0) {
+                if (Diag::ETHERNET)  DIAG(F("Ethernet: available socket=%d,avail=%d"), socket, available);
+                // read bytes from a client
+                int count = clients[socket].read(buffer, MAX_ETH_BUFFER);
+                if (Diag::ETHERNET) DIAG(F(",count=%d"), count);
+                // A command may be split over several reads or several commands may
+                // arrive in one, so the client's framer decides where each one ends.
+                for (int i=0;i<count;i++) {
+                    int length=framers[socket].add(buffer[i]);
+                    if (length==CommandFramer::TOO_LONG) {
+                        outboundRing->mark(socket);
+                        framers[socket].reject(outboundRing);
+                        outboundRing->commit();
+                        continue;
+                    }
+                    if (!length) continue;
+                    byte * command=framers[socket].frame();
+                    if (Diag::ETHERNET) DIAG(F("Ethernet command %d:%e"), socket, command);
+                    RECORD_COMMAND(RECORD_ETHERNET+socket, command, length);
+                    // execute with data going directly back
+                    outboundRing->mark(socket); 
+                    CommandDistributor::parse(socket,command,length,outboundRing);
+                    outboundRing->commit();
+                }
+                busy=true;
+                if (micros()-startTime >= COMMAND_BUDGET_MICROS || outboundRing->freeSpace() < MIN_ETH_REPLY_SPACE) break;
+            }
         }
     }
 
@@ -176,13 +203,13 @@ void EthernetInterface::loop()
    for (int socket = 0; socket<MAX_SOCK_NUM; socket++) {
      if (clients[socket] && !clients[socket].connected()) {
       clients[socket].stop();
+      CurrentMeters::unsubscribe(outboundRing, socket);
       if (Diag::ETHERNET)  DIAG(F("Ethernet: disconnect %d "), socket);             
      }
     }
     
-    // handle at most 1 outbound transmission 
-    int socketOut=outboundRing->read();
-    if (socketOut>=0) {
+    // send the replies, there may be one for each command above
+    for (int socketOut=outboundRing->read(); socketOut>=0; socketOut=outboundRing->read()) {
       int count=outboundRing->count();
       if (Diag::ETHERNET) DIAG(F("Ethernet reply socket=%d, count=:%d"), socketOut,count);
       for(;count>0;count--)  clients[socketOut].write(outboundRing->read());
@@ -38,6 +38,7 @@
  #include "Ethernet.h"
 #endif
 #include "RingStream.h"
+#include "CommandFramer.h"
 
 /**
  * @brief Network Configuration
@@ -46,6 +47,7 @@
 
 #define MAX_ETH_BUFFER 512
 #define OUTBOUND_RING_SIZE 2048
+#define MIN_ETH_REPLY_SPACE 512 // outbound space needed to run another command
 
 class EthernetInterface {
 
@@ -61,8 +63,10 @@ class EthernetInterface {
      void loop2();
     EthernetServer * server;
     EthernetClient clients[MAX_SOCK_NUM];                // accept up to MAX_SOCK_NUM client connections at the same time; This depends on the chipset used on the Shield
-    uint8_t buffer[MAX_ETH_BUFFER+1];                    // buffer used by TCP for the recv
+    uint8_t buffer[MAX_ETH_BUFFER];                      // buffer used by TCP for the recv
+    CommandFramer framers[MAX_SOCK_NUM];                 // partial command of each client
     RingStream * outboundRing;
+    byte nextSocket=0;   // first client to read next time round
   
 };
 
@@ -0,0 +1,133 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef Keywords_h
+#define Keywords_h
+#include <Arduino.h>
+#include "FSH.h"
+
+/* Command keywords such as <1 MAIN> or <D ACK ON>.
+ *
+ * splitValues turns a keyword parameter into an int16_t as it reads it.
+ * keywordHash() does the same sum at compile time, so a keyword is added by
+ * putting its name in DCCEX_KEYWORDS, which gives
+ *    HASH_KEYWORD_name   the parameter value, for comparing with p[n]
+ *    KEYWORD_name        for switch (keyword(p[n]))
+ *
+ * The hashes are checked to be different at compile time, and a multiplier
+ * is found that puts every keyword in its own slot of a FLASH table so
+ * keyword() needs a single probe and one compare.
+ *
+ * Only C++11 constexpr is used because that is what the AVR toolchain gives us.
+ */
+
+#define DCCEX_KEYWORDS(K) \
+  K(PROG) K(MAIN) K(JOIN) K(CABS) K(RAM) K(CMD) K(WIT) K(WIFI) K(ACK) K(ON) \
+  K(PROGBOOST) K(EEPROM) K(LIMIT) K(ETHERNET) K(MAX) K(MIN) K(LCN) K(RESET) \
+  K(SPEED28) K(SPEED128) K(TUNE) K(POWERLOG) K(PROFILE) K(BENCH) \
+  K(RECORD) K(OFF) K(DUMP) K(PLAY) K(FAST) K(SIMDECODER) K(CV) K(LOAD) K(RUN)
+
+// Same sum as DCCEXParser::splitValues: digits as 10*v+digit, letters (upper cased) as ((v<<5)+v)^ch
+constexpr uint16_t keywordStep(uint16_t v, char ch) {
+  return (ch>='0' && ch<='9') ? (uint16_t)(10*(uint32_t)v + (ch-'0'))
+       : (uint16_t)((33*(uint32_t)v) ^ (uint32_t)((ch>='a' && ch<='z') ? ch-'a'+'A' : ch));
+}
+
+constexpr int16_t keywordHash(const char * name, uint16_t v=0) {
+  return *name ? keywordHash(name+1, keywordStep(v, *name)) : (int16_t)v;
+}
+
+#define KEYWORD_ENUM(name) KEYWORD_##name,
+enum KEYWORD : byte { DCCEX_KEYWORDS(KEYWORD_ENUM) KEYWORD_COUNT, KEYWORD_NONE=255 };
+#undef KEYWORD_ENUM
+
+#define KEYWORD_HASH(name) constexpr int16_t HASH_KEYWORD_##name = keywordHash(#name);
+DCCEX_KEYWORDS(KEYWORD_HASH)
+#undef KEYWORD_HASH
+
+#define KEYWORD_HASH_ENTRY(name) HASH_KEYWORD_##name,
+constexpr int16_t keywordHashes[] = { DCCEX_KEYWORDS(KEYWORD_HASH_ENTRY) };
+#undef KEYWORD_HASH_ENTRY
+
+// Slot table
+
+const byte KEYWORD_SLOT_BITS=7;
+
+constexpr byte keywordSlot(int16_t hash, uint16_t multiplier) {
+  return (uint16_t)((uint32_t)(uint16_t)hash * multiplier) >> (16-KEYWORD_SLOT_BITS);
+}
+
+// no keyword after i has the same hash as i, and so on for every i
+constexpr bool keywordHashUnique(byte i, byte j) {
+  return j>=KEYWORD_COUNT || (keywordHashes[i]!=keywordHashes[j] && keywordHashUnique(i, j+1));
+}
+constexpr bool keywordHashesUnique(byte i=0) {
+  return i>=KEYWORD_COUNT || (keywordHashUnique(i, i+1) && keywordHashesUnique(i+1));
+}
+
+constexpr bool keywordSlotUnique(uint16_t multiplier, byte i, byte j) {
+  return j>=KEYWORD_COUNT || (keywordSlot(keywordHashes[i], multiplier)!=keywordSlot(keywordHashes[j], multiplier)
+                              && keywordSlotUnique(multiplier, i, j+1));
+}
+constexpr bool keywordSlotsUnique(uint16_t multiplier, byte i=0) {
+  return i>=KEYWORD_COUNT || (keywordSlotUnique(multiplier, i, i+1) && keywordSlotsUnique(multiplier, i+1));
+}
+
+// First odd multiplier from the golden ratio up that gives every keyword its own slot.
+// If this runs out of constexpr depth the table needs more KEYWORD_SLOT_BITS.
+constexpr uint16_t keywordMultiplier(uint16_t multiplier=0x9E37) {
+  return keywordSlotsUnique(multiplier) ? multiplier : keywordMultiplier(multiplier+2);
+}
+
+static_assert(KEYWORD_COUNT < (1<<KEYWORD_SLOT_BITS)/2, "too many keywords for the slot table");
+static_assert(keywordHashesUnique(), "two keywords have the same hash, rename one");
+constexpr uint16_t KEYWORD_MULTIPLIER=keywordMultiplier();
+
+constexpr byte keywordInSlot(byte slot, byte k=0) {
+  return k>=KEYWORD_COUNT ? (byte)KEYWORD_NONE
+       : keywordSlot(keywordHashes[k], KEYWORD_MULTIPLIER)==slot ? k : keywordInSlot(slot, k+1);
+}
+
+// Index pack for expanding the tables into FLASH array initialisers
+template<size_t... I> struct KeywordIndices {};
+template<size_t N, size_t... I> struct KeywordMakeIndices : KeywordMakeIndices<N-1, N-1, I...> {};
+template<size_t... I> struct KeywordMakeIndices<0, I...> { typedef KeywordIndices<I...> type; };
+
+template<typename SLOTS, typename KEYWORDS> struct KeywordTable;
+template<size_t... S, size_t... K> struct KeywordTable<KeywordIndices<S...>, KeywordIndices<K...> > {
+  static const byte slots[sizeof...(S)];
+  static const int16_t hashes[sizeof...(K)];
+};
+template<size_t... S, size_t... K>
+const byte KeywordTable<KeywordIndices<S...>, KeywordIndices<K...> >::slots[sizeof...(S)] FLASH = { keywordInSlot(S)... };
+template<size_t... S, size_t... K>
+const int16_t KeywordTable<KeywordIndices<S...>, KeywordIndices<K...> >::hashes[sizeof...(K)] FLASH = { keywordHashes[K]... };
+
+typedef KeywordTable<KeywordMakeIndices<1<<KEYWORD_SLOT_BITS>::type, KeywordMakeIndices<KEYWORD_COUNT>::type> Keywords;
+
+// The keyword a parameter value is, or KEYWORD_NONE. A 32 bit parameter
+// (COMMAND_PARAMS_32BIT) too big for int16_t is not cut down to one.
+template<typename T> inline KEYWORD keyword(T value) {
+  if (value!=(int16_t)value) return KEYWORD_NONE;
+  int16_t hash=(int16_t)value;
+  byte k=GETFLASH(&Keywords::slots[keywordSlot(hash, KEYWORD_MULTIPLIER)]);
+  if (k==KEYWORD_NONE || (int16_t)GETFLASHW(&Keywords::hashes[k])!=hash) return KEYWORD_NONE;
+  return (KEYWORD)k;
+}
+
+#endif
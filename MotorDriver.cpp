@@ -46,6 +46,10 @@ MotorDriver::MotorDriver(byte power_pin, byte signal_pin, byte signal_pin2, int8
     pinMode(signalPin2, OUTPUT);
   }
   else dualSignal=false; 
+
+  signalWrites=0;
+  addSignalWrite(fastSignalPin, true);
+  if (dualSignal) addSignalWrite(fastSignalPin2, false);
   
   brakePin=brake_pin;
   if (brake_pin!=UNUSED_PIN){
@@ -61,6 +65,11 @@ MotorDriver::MotorDriver(byte power_pin, byte signal_pin, byte signal_pin2, int8
   if (currentPin!=UNUSED_PIN) {
     pinMode(currentPin, INPUT);
     senseOffset=analogRead(currentPin); // value of sensor at zero current
+    currentSlot=ADCee::init(currentPin);
+    if (currentSlot==ADCee::UNUSED_SLOT) {
+      DIAG(F("MotorDriver ** WARNING ** Too many current pins, A%d ignored"),currentPin-A0);
+      currentPin=UNUSED_PIN;
+    }
   }
 
   faultPin=fault_pin;
@@ -69,9 +78,10 @@ MotorDriver::MotorDriver(byte power_pin, byte signal_pin, byte signal_pin2, int8
     pinMode(faultPin, INPUT);
   }
 
-  senseFactor=sense_factor;
+  // Converted once here so the current readings only need integer sums
+  senseFactorQ16=::senseFactorQ16(sense_factor);
   tripMilliamps=trip_milliamps;
-  rawCurrentTripValue=(int)(trip_milliamps / sense_factor);
+  rawCurrentTripValue=MotorDriver::mA2raw(trip_milliamps);
   
   if (currentPin==UNUSED_PIN) 
     DIAG(F("MotorDriver ** WARNING ** No current or short detection"));  
@@ -126,6 +136,26 @@ void MotorDriver::setSignal( bool high) {
    }
 }
 
+// Add a signal pin to the write plan, highWithSignal is false for the inverted signalPin2
+void MotorDriver::addSignalWrite(const FASTPIN & pin, bool highWithSignal) {
+  byte w=0;
+  while (w<signalWrites && signalPlan[w].port!=pin.inout) w++;
+  if (w==signalWrites) {
+    signalPlan[w].port=pin.inout;
+    signalPlan[w].keep=(PORTREG)~0;
+    signalPlan[w].highBits=0;
+    signalPlan[w].lowBits=0;
+    signalWrites++;
+  }
+  signalPlan[w].keep &= pin.maskLOW;
+  if (highWithSignal) signalPlan[w].highBits |= pin.maskHIGH;
+  else signalPlan[w].lowBits |= pin.maskHIGH;
+}
+
+bool MotorDriver::canSetSignalFast() {
+  return !usePWM;
+}
+
 #if defined(ARDUINO_TEENSY32) || defined(ARDUINO_TEENSY35)|| defined(ARDUINO_TEENSY36)
 volatile unsigned int overflow_count=0;
 #endif
@@ -140,38 +170,45 @@ bool MotorDriver::canMeasureCurrent() {
  * 
  * senseOffset handles the case where a shield returns values above or below 
  * a central value depending on direction.
+ *
+ * average=true smooths over the last few samples (about 1mS) for callers that
+ * only look occasionally, the default is the single latest sample.
  */
-int MotorDriver::getCurrentRaw() {
+int MotorDriver::getCurrentRaw(bool average) {
   if (currentPin==UNUSED_PIN) return 0; 
   int current;
 #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
   bool irq = disableInterrupts();
-  current = analogRead(currentPin)-senseOffset;
+  current = (average ? ADCee::readAverage(currentSlot) : ADCee::read(currentSlot))-senseOffset;
   enableInterrupts(irq);
 #elif defined(ARDUINO_TEENSY32) || defined(ARDUINO_TEENSY35)|| defined(ARDUINO_TEENSY36)
   unsigned char sreg_backup;
   sreg_backup = SREG;   /* save interrupt enable/disable state */
   cli();
-  current = analogRead(currentPin)-senseOffset;
+  current = (average ? ADCee::readAverage(currentSlot) : ADCee::read(currentSlot))-senseOffset;
   overflow_count = 0;
   SREG = sreg_backup;    /* restore interrupt state */
 #else
-  current = analogRead(currentPin)-senseOffset;
+  current = (average ? ADCee::readAverage(currentSlot) : ADCee::read(currentSlot))-senseOffset;
 #endif
   if (current<0) current=0-current;
   if ((faultPin != UNUSED_PIN)  && isLOW(fastFaultPin) && isHIGH(fastPowerPin))
       return (current == 0 ? -1 : -current);
   return current;
   // IMPORTANT:  This function can be called in Interrupt() time within the 56uS timer
-  //             The default analogRead takes ~100uS which is catastrphic
-  //             so DCCTimer has set the sample time to be much faster.  
+  //             so must never wait for a conversion. ADCee keeps the latest
+  //             samples; where it can't (ADCee::SCANNING false) the overload
+  //             sampling is done from loop() and DCCTimer has set the
+  //             analogRead sample time to be much faster for the ACK checks.
 }
 
+// Sense factors up to about 60 keep a 10 bit reading inside the unsigned long
 unsigned int MotorDriver::raw2mA( int raw) {
-  return (unsigned int)(raw * senseFactor);
+  if (raw<0) return 0;
+  return (unsigned int)(((unsigned long)raw * senseFactorQ16) >> 16);
 }
 int MotorDriver::mA2raw( unsigned int mA) {
-  return (int)(mA / senseFactor);
+  return (int)(((unsigned long)mA << 16) / senseFactorQ16);
 }
 
 void  MotorDriver::getFastPin(const FSH* type,int pin, bool input, FASTPIN & result) {
@@ -27,18 +27,41 @@
 #endif
 
 #if defined(__IMXRT1062__)
-struct FASTPIN {
-  volatile uint32_t *inout;
-  uint32_t maskHIGH;  
-  uint32_t maskLOW;  
-};
+typedef uint32_t PORTREG;
 #else
+typedef uint8_t PORTREG;
+#endif
+
 struct FASTPIN {
-  volatile uint8_t *inout;
-  uint8_t maskHIGH;  
-  uint8_t maskLOW;  
+  volatile PORTREG *inout;
+  PORTREG maskHIGH;  
+  PORTREG maskLOW;  
 };
-#endif
+
+// One port write of the signal pins: *port = (*port & keep) | (high ? highBits : lowBits)
+struct SIGNALWRITE {
+  volatile PORTREG *port;
+  PORTREG keep;
+  PORTREG highBits;
+  PORTREG lowBits;
+};
+
+// Sense factor (mA per raw unit) as the 16.16 fixed point multiplier raw2mA() uses
+constexpr unsigned long senseFactorQ16(float senseFactor) {
+  return (unsigned long)(senseFactor * 65536.0f + 0.5f) ? (unsigned long)(senseFactor * 65536.0f + 0.5f) : 1;
+}
+
+// Compile time check that the fixed point conversions are within 1 of the
+// float ones they replaced, over raw lo..hi and mA lo..hi. The range is
+// halved each call because C++11 constexpr only has recursion.
+constexpr bool senseWithinOne(uint32_t a, uint32_t b) {
+  return a>b ? a-b<=1 : b-a<=1;
+}
+constexpr bool senseFactorAccurate(float senseFactor, uint32_t lo=0, uint32_t hi=6000) {
+  return lo==hi ? (lo>1023 || senseWithinOne((lo * senseFactorQ16(senseFactor)) >> 16, (uint32_t)(lo * senseFactor)))
+                  && senseWithinOne((lo << 16) / senseFactorQ16(senseFactor), (uint32_t)(lo / senseFactor))
+       : senseFactorAccurate(senseFactor, lo, (lo+hi)/2) && senseFactorAccurate(senseFactor, (lo+hi)/2+1, hi);
+}
 
 class MotorDriver {
   public:
@@ -46,8 +69,22 @@ class MotorDriver {
                 byte current_pin, float senseFactor, unsigned int tripMilliamps, byte faultPin);
     virtual void setPower( bool on);
     virtual void setSignal( bool high);
+    // setSignalFast() is the non virtual equivalent of setSignal() for interrupt time,
+    // with the pin writes worked out in advance. Only valid if canSetSignalFast().
+    virtual bool canSetSignalFast();
+    inline byte getSignalWrites() {
+      return signalWrites;
+    }
+    inline const SIGNALWRITE & getSignalWrite(byte w) {
+      return signalPlan[w];
+    }
+    inline void setSignalFast( bool high) {
+      *signalPlan[0].port = (*signalPlan[0].port & signalPlan[0].keep) | (high ? signalPlan[0].highBits : signalPlan[0].lowBits);
+      if (signalWrites>1)
+        *signalPlan[1].port = (*signalPlan[1].port & signalPlan[1].keep) | (high ? signalPlan[1].highBits : signalPlan[1].lowBits);
+    }
     virtual void setBrake( bool on);
-    virtual int  getCurrentRaw();
+    virtual int  getCurrentRaw(bool average=false);
     virtual unsigned int raw2mA( int raw);
     virtual int mA2raw( unsigned int mA);
     inline int getRawCurrentTripValue() {
@@ -65,11 +102,15 @@ class MotorDriver {
     void  getFastPin(const FSH* type,int pin, FASTPIN & result) {
 	getFastPin(type, pin, 0, result);
     }
+    void  addSignalWrite(const FASTPIN & pin, bool highWithSignal);
     byte powerPin, signalPin, signalPin2, currentPin, faultPin, brakePin;
+    byte currentSlot;      // ADCee sample slot for currentPin
     FASTPIN fastPowerPin,fastSignalPin, fastSignalPin2, fastBrakePin,fastFaultPin;
+    SIGNALWRITE signalPlan[2]; // signalPin and signalPin2, merged if on the same port
+    byte signalWrites;
     bool dualSignal;       // true to use signalPin2
     bool invertBrake;       // brake pin passed as negative means pin is inverted
-    float senseFactor;
+    unsigned long senseFactorQ16;  // mA per raw unit, 16.16 fixed point
     int senseOffset;
     unsigned int tripMilliamps;
     int rawCurrentTripValue;
@@ -22,6 +22,7 @@
 #ifndef MotorDrivers_h
 #define MotorDrivers_h
 #include <Arduino.h>
+#include "SimulatedDecoder.h"
 
 // *** PLEASE NOTE *** THIS FILE IS  **NOT**  INTENDED TO BE EDITED WHEN CONFIGURING A SYSTEM.
 // It will be overwritten if the library is updated.
@@ -83,4 +84,20 @@
                          new MotorDriver(4, 5, 6, UNUSED_PIN, A5, 41.54, 5000, UNUSED_PIN), \
                          new MotorDriver(11, 13, UNUSED_PIN, UNUSED_PIN, A1, 2.99, 2000, UNUSED_PIN)
 
+// Arduino standard Motor Shield with a simulated decoder on the prog track.
+// For exercising and timing the programming track without a real decoder.
+#define SIMULATED_DECODER_SHIELD F("SIMULATED_DECODER_SHIELD"),                                              \
+                         new MotorDriver(3, 12, UNUSED_PIN, UNUSED_PIN, A0, 2.99, 2000, UNUSED_PIN), \
+                         new SimulatedDecoder(11, 13, UNUSED_PIN, UNUSED_PIN, A1, 2.99, 2000, UNUSED_PIN)
+
+// Every sense factor used above must convert to fixed point within 1mA / 1 raw unit.
+// Add any new one here.
+#define CHECK_SENSE_FACTOR(factor) static_assert(senseFactorAccurate(factor), "sense factor " #factor " loses accuracy in fixed point")
+CHECK_SENSE_FACTOR(2.99);
+CHECK_SENSE_FACTOR(18);
+CHECK_SENSE_FACTOR(9.766);
+CHECK_SENSE_FACTOR(5.00);
+CHECK_SENSE_FACTOR(41.54);
+#undef CHECK_SENSE_FACTOR
+
 #endif
@@ -0,0 +1,56 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "PowerLog.h"
+#include "StringFormatter.h"
+
+PowerLog::Entry PowerLog::entries[PowerLog::SIZE];
+byte PowerLog::next=0;
+unsigned int PowerLog::total=0;
+
+void PowerLog::record(POWEREVENT event, char track, int current, int trip, unsigned int backoff) {
+  Entry & e=entries[next];
+  e.time=millis();
+  e.event=event;
+  e.track=track;
+  e.current=current;
+  e.trip=trip;
+  e.backoff=backoff;
+  if (++next>=SIZE) next=0;
+  if (total<0xFFFF) total++;
+}
+
+// Oldest first, one line each:  millis track event current trip backoff
+void PowerLog::dump(Print * stream) {
+  byte count= total<SIZE ? total : SIZE;
+  StringFormatter::send(stream, F("POWERLOG events=%d now=%l\n"), total, millis());
+  byte i= (next + SIZE - count) % SIZE;
+  for (byte n=0; n<count; n++) {
+    Entry & e=entries[i];
+    const FSH * name;
+    switch (e.event) {
+      case POWEREVENT::OVERLOAD:     name=F("OVERLOAD"); break;
+      case POWEREVENT::FAST_TRIP:    name=F("FASTTRIP"); break;
+      case POWEREVENT::FAULT:        name=F("FAULT"); break;
+      case POWEREVENT::COMMON_FAULT: name=F("COMMONFAULT"); break;
+      default:                       name=F("RESET"); break;
+    }
+    StringFormatter::send(stream, F("%l %c %S %d %d %d\n"), e.time, e.track, name, e.current, e.trip, e.backoff);
+    if (++i>=SIZE) i=0;
+  }
+}
@@ -0,0 +1,53 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PowerLog_h
+#define PowerLog_h
+#include <Arduino.h>
+
+// Journal of the most recent track power events, kept in RAM so they can be
+// looked at with <D POWERLOG> after the fact. Recording an event only copies
+// a few values, all the formatting is done by dump().
+
+enum class POWEREVENT : byte { OVERLOAD, FAST_TRIP, FAULT, COMMON_FAULT, RESET };
+
+class PowerLog {
+  public:
+    // track is 'M', 'P' or the district digit, values in mA and backoff in mS
+    static void record(POWEREVENT event, char track, int current, int trip, unsigned int backoff);
+    static void dump(Print * stream);
+
+  private:
+#ifdef ARDUINO_AVR_UNO
+    static const byte SIZE=8;
+#else
+    static const byte SIZE=16;
+#endif
+    struct Entry {
+      unsigned long time;   // millis
+      POWEREVENT event;
+      char track;
+      int current;
+      int trip;
+      unsigned int backoff;
+    };
+    static Entry entries[SIZE];
+    static byte next;
+    static unsigned int total;  // events ever recorded
+};
+#endif
@@ -0,0 +1,113 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "Profiler.h"
+#ifdef ENABLE_PROFILER
+#include "StringFormatter.h"
+
+Profiler::Stats Profiler::stats[PROFILE_POINTS];
+unsigned long Profiler::commandTime=0;
+volatile unsigned long Profiler::packetTime=0;
+unsigned int Profiler::latencyHistogram[LATENCY_BUCKETS];
+unsigned long Profiler::latencyCount=0;
+unsigned long Profiler::latencyMax=0;
+
+// Called from interrupt() time as well as the loop
+void Profiler::record(PROFILE_POINT point, unsigned long cycles) {
+  byte sreg=SREG;
+  cli();
+  Stats & s=stats[point];
+  if (s.count==0 || cycles<s.minimum) s.minimum=cycles;
+  if (cycles>s.maximum) s.maximum=cycles;
+  s.sum+=cycles;
+  s.count++;
+  SREG=sreg;
+}
+
+void Profiler::dump(Print * stream) {
+  static const char names[PROFILE_POINTS][12] PROGMEM = 
+    {"ISR", "ISRBIT", "CHECKACK", "PARSE", "SPLITVALUES", "SEND"};
+  for (byte p=0; p<PROFILE_POINTS; p++) {
+    noInterrupts();
+    Stats s=stats[p];
+    interrupts();
+    StringFormatter::send(stream, F("PROFILE %S %l %l %l %l\n"), (const FSH *)names[p], 
+                          s.count, s.minimum, s.count ? s.sum/s.count : 0, s.maximum);
+  }
+  StringFormatter::send(stream, F("LATENCY %l %l %l %l %l\n"), latencyCount,
+                        latencyPercentile(50), latencyPercentile(90), latencyPercentile(99), latencyMax);
+}
+
+// Upper bound of the bucket holding the given percentile, or the maximum if that is lower
+unsigned long Profiler::latencyPercentile(byte percent) {
+  noInterrupts();
+  unsigned long count=latencyCount;
+  unsigned long maximum=latencyMax;
+  interrupts();
+  if (count==0) return 0;
+  unsigned long target=(count*percent+99)/100;
+  unsigned long seen=0;
+  for (byte b=0; b<LATENCY_BUCKETS-1; b++) {
+    noInterrupts();
+    seen+=latencyHistogram[b];
+    interrupts();
+    if (seen>=target) {
+      unsigned long bound=((unsigned long)(b+1))<<LATENCY_BUCKET_SHIFT;
+      return bound<maximum ? bound : maximum;
+    }
+  }
+  return maximum;
+}
+
+void Profiler::commandStart() {
+  commandTime=micros();
+  if (commandTime==0) commandTime=1;
+}
+
+void Profiler::commandEnd() {
+  commandTime=0;
+}
+
+// Called by the main track before it makes a packet pending, only the first
+// packet of each command is timed.
+void Profiler::packetScheduled() {
+  packetTime=commandTime;
+  commandTime=0;
+}
+
+// Called in interrupt() time when the main track starts the pending packet
+void Profiler::packetStarted() {
+  if (packetTime==0) return;
+  unsigned long latency=micros()-packetTime;
+  packetTime=0;
+  unsigned long bucket=latency>>LATENCY_BUCKET_SHIFT;
+  if (bucket>=LATENCY_BUCKETS) bucket=LATENCY_BUCKETS-1;
+  if (latencyHistogram[bucket]<65535) latencyHistogram[bucket]++;
+  if (latency>latencyMax) latencyMax=latency;
+  latencyCount++;
+}
+
+void Profiler::reset() {
+  noInterrupts();
+  memset(stats, 0, sizeof(stats));
+  memset(latencyHistogram, 0, sizeof(latencyHistogram));
+  latencyCount=0;
+  latencyMax=0;
+  interrupts();
+}
+#endif
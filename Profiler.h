@@ -0,0 +1,114 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef Profiler_h
+#define Profiler_h
+#include <Arduino.h>
+#if __has_include ( "config.h")
+  #include "config.h"
+#endif
+
+// Cycle count profiling of the timing critical paths, only built with
+// #define ENABLE_PROFILER in config.h (or -DENABLE_PROFILER).
+//
+// Interrupt paths are timed in CPU cycles from the DCC timer, loop paths from
+// micros() so they are only good to 4uS and include any interrupts. 
+// <D PROFILE> prints one line per point, <D PROFILE RESET> clears them, so
+// a script (on the real board, or with the firmware running under a simulator 
+// such as simavr) can send a command, dump, reset and compare builds:
+//    PROFILE point count min avg max
+// with min, avg and max in CPU cycles.
+//
+// Command to rail latency is measured from a command arriving (serial or
+// CommandDistributor) to the preamble of the first main track packet it 
+// scheduled starting on the rail, and printed as
+//    LATENCY count p50 p90 p99 max
+// in uS. Percentiles are to the LATENCY_BUCKET_SHIFT resolution.
+//
+// <D PROFILE BENCH [cab]> runs the parser, formatter, ring buffer and loco
+// lookup hot paths a thousand times each and prints one JSON object per line
+//    {"bench":"name","iter":iterations,"ns":ns/op,"heap":heapbytes}
+// The loco lookup is skipped unless cab (default 3) is already in the speed table.
+
+enum PROFILE_POINT : byte {
+  PROFILE_ISR,          // whole DCC interrupt, from the timer tick
+  PROFILE_ISR_BIT,      // DCC interrupts that worked out a new bit
+  PROFILE_CHECKACK,     // DCCWaveform::checkAck
+  PROFILE_PARSE,        // DCCEXParser::parse, one command
+  PROFILE_SPLITVALUES,  // DCCEXParser::splitValues
+  PROFILE_SEND,         // StringFormatter::send2, one reply or diag
+  PROFILE_POINTS
+};
+
+#ifdef ENABLE_PROFILER
+#if !defined(ARDUINO_ARCH_AVR) && !defined(ARDUINO_ARCH_MEGAAVR)
+#error ENABLE_PROFILER is only supported on AVR boards
+#endif
+#include "DCCTimer.h"
+
+class Profiler {
+  public:
+    static void record(PROFILE_POINT point, unsigned long cycles);
+    static void dump(Print * stream);
+    static void reset();
+    static void commandStart();
+    static void commandEnd();
+    static void packetScheduled();
+    static void packetStarted();
+  private:
+    static const byte LATENCY_BUCKET_SHIFT=9;   // 512uS buckets
+    static const byte LATENCY_BUCKETS=48;       // last one catches anything slower
+    static unsigned long latencyPercentile(byte percent);
+    struct Stats {
+      unsigned long count;
+      unsigned long sum;
+      unsigned long minimum;
+      unsigned long maximum;
+    };
+    static Stats stats[PROFILE_POINTS];
+    static unsigned long commandTime;          // micros, 0 when no command or packet already scheduled
+    static volatile unsigned long packetTime;  // micros of the command that scheduled the pending packet
+    static unsigned int latencyHistogram[LATENCY_BUCKETS];
+    static unsigned long latencyCount;
+    static unsigned long latencyMax;
+};
+
+#define PROFILE_TICK_START()               DCCTimer::startCycleCount()
+#define PROFILE_TICK_END(point)            Profiler::record(point, DCCTimer::getCycleCount())
+#define PROFILE_CYCLES_START(var)          unsigned int var=DCCTimer::getCycleCount()
+#define PROFILE_CYCLES_END(var, point)     Profiler::record(point, DCCTimer::getCycleCount()-var)
+#define PROFILE_MICROS_START(var)          unsigned long var=micros()
+#define PROFILE_MICROS_END(var, point)     Profiler::record(point, (micros()-var)*(F_CPU/1000000UL))
+#define PROFILE_COMMAND_START()            Profiler::commandStart()
+#define PROFILE_COMMAND_END()              Profiler::commandEnd()
+#define PROFILE_PACKET_SCHEDULED()         Profiler::packetScheduled()
+#define PROFILE_PACKET_STARTED()           Profiler::packetStarted()
+#else
+#define PROFILE_TICK_START()
+#define PROFILE_TICK_END(point)
+#define PROFILE_CYCLES_START(var)
+#define PROFILE_CYCLES_END(var, point)
+#define PROFILE_MICROS_START(var)
+#define PROFILE_MICROS_END(var, point)
+#define PROFILE_COMMAND_START()
+#define PROFILE_COMMAND_END()
+#define PROFILE_PACKET_SCHEDULED()         do {} while (0)
+#define PROFILE_PACKET_STARTED()           do {} while (0)
+#endif
+
+#endif
@@ -81,6 +81,16 @@ uint8_t RingStream::peekTargetMark() {
   return _buffer[_mark];
 }
 
+int RingStream::written() {
+  return _count;
+}
+
+// Overwrite a byte already written since mark(), for a length only known at the end
+void RingStream::patch(int offset, uint8_t b) {
+  if (_overflow || offset<0 || offset>=_count) return;
+  _buffer[(_mark+3+offset) % _len]=b;
+}
+
 bool RingStream::commit() {
   if (_overflow) {
         DIAG(F("RingStream(%d) commit(%d) OVERFLOW"),_len, _count);
@@ -103,3 +113,40 @@ bool RingStream::commit() {
   _buffer[_mark]=lowByte(_count);
   return true; // commit worked
 }
+
+// Like mark() for a message of exactly length bytes, but the bytes will follow
+// each other in the buffer so peekContiguous() can hand them out in place.
+// If they would wrap round the end of the buffer a PADDING_MARK message
+// is written first to fill up to the end. Returns false, writing nothing,
+// if the message does not fit.
+bool RingStream::markContiguous(uint8_t b, int length) {
+  if (length<=0 || length>_len-4) return false;
+  int dataStart=(_pos_write+3) % _len;
+  bool pad= dataStart+length > _len;
+  // padding bytes to put the next header just before the end, none if the padding header gets past it
+  int padding= (pad && _pos_write < _len-6) ? _len-6-_pos_write : 0;
+  if (pad && (_pos_write+6+padding) % _len + length > _len) return false;
+  int needed= (pad ? padding+3 : 0) + length + 3;
+  int free= _pos_read>_pos_write ? _pos_read-_pos_write : _len-_pos_write+_pos_read;
+  if (_overflow || needed>=free) return false;  // must leave one byte between write and read
+  if (pad) {
+    mark(PADDING_MARK);
+    for (int i=0;i<padding;i++) write((uint8_t)0);
+    if (padding) commit();  // an empty one is complete already
+  }
+  mark(b);
+  return true;
+}
+
+// The next length bytes in the buffer, or NULL if they are not contiguous.
+// They stay in the ring until skip().
+byte * RingStream::peekContiguous(int length) {
+  if (_pos_read+length > _len) return NULL;
+  return _buffer+_pos_read;
+}
+
+void RingStream::skip(int length) {
+  if (length<=0) return;
+  _pos_read=(_pos_read+length) % _len;
+  _overflow=false;
+}
@@ -34,6 +34,14 @@ class RingStream : public Print {
     void mark(uint8_t b);
     bool commit();
     uint8_t peekTargetMark();
+    int written();   // bytes since mark()
+    void patch(int offset, uint8_t b);
+
+    // Messages whose data is kept in one piece so the reader can use it in place
+    static const uint8_t PADDING_MARK=0xFF;   // mark of a message that only fills to the end of the buffer
+    bool markContiguous(uint8_t b, int length);
+    byte * peekContiguous(int length);
+    void skip(int length);
     
  private:
    int _len;
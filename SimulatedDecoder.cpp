@@ -0,0 +1,349 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <Arduino.h>
+#include "SimulatedDecoder.h"
+#include "DCC.h"
+#include "Keywords.h"
+#include "StringFormatter.h"
+#include "DIAG.h"
+
+SimulatedDecoder * SimulatedDecoder::instance=NULL;
+byte SimulatedDecoder::runProgram=SimulatedDecoder::RUN_DONE;
+int SimulatedDecoder::runCount;
+int SimulatedDecoder::runDone;
+int SimulatedDecoder::runFailures;
+int16_t SimulatedDecoder::runExpected;
+unsigned long SimulatedDecoder::runStart;
+
+SimulatedDecoder::SimulatedDecoder(byte power_pin, byte signal_pin, byte signal_pin2, int8_t brake_pin,
+                         byte current_pin, float sense_factor, unsigned int trip_milliamps, byte fault_pin)
+  : MotorDriver(power_pin, signal_pin, signal_pin2, brake_pin, current_pin, sense_factor, trip_milliamps, fault_pin) {
+  memset(cvs, 0, sizeof(cvs));
+  cvs[1-1]=3;     // short address 3
+  cvs[7-1]=1;     // version
+  cvs[8-1]=13;    // manufacturer: public domain
+  cvs[29-1]=6;    // 28/128 speed steps, analog conversion
+  powered=false;
+  decodeState=PREAMBLE;
+  highHalves=0;
+  preambleCount=0;
+  lastLength=0;
+  repeatCount=0;
+  serviceMode=false;
+  ackActive=false;
+  noiseSeed=0xACE1;
+  setAckPulse(60+20, 6000, 1000);  // NMRA minimum 60mA for 6mS, plus some margin
+  setLoad(10, 0);
+  instance=this;
+  DIAG(F("SimulatedDecoder on prog track, CV1-%d"), CV_COUNT);
+}
+
+void SimulatedDecoder::setCV(int cv, byte value) {
+  if (cv<1 || cv>CV_COUNT) return;
+  cvs[cv-1]=value;
+}
+
+// getCurrentRaw() reads these in interrupt() time, and they are two bytes on AVR
+void SimulatedDecoder::setAckPulse(unsigned int mA, unsigned int durationUs, unsigned int latencyUs) {
+  int raw=mA2raw(mA);
+  noInterrupts();
+  ackRaw=raw;
+  ackDuration=durationUs;
+  ackLatency=latencyUs;
+  interrupts();
+}
+
+void SimulatedDecoder::setLoad(unsigned int idlemA, unsigned int noisemA) {
+  int idle=mA2raw(idlemA);
+  int noise=mA2raw(noisemA);
+  noInterrupts();
+  idleRaw=idle;
+  noiseRaw=noise;
+  interrupts();
+}
+
+// Values are mA, uS or a count, all kept in 16 bits
+static bool inRange(COMMAND_PARAM value) {
+  return value>=0 && value==(int16_t)value;
+}
+
+bool SimulatedDecoder::command(Print * stream, COMMAND_PARAM action, COMMAND_PARAM a, COMMAND_PARAM b, COMMAND_PARAM c) {
+  if (!instance) return false;
+  switch (keyword(action)) {
+    case KEYWORD_CV:
+      if (a<1 || a>CV_COUNT || b<0 || b>255) return false;
+      noInterrupts();
+      instance->cvs[a-1]=b;
+      interrupts();
+      break;
+    case KEYWORD_ACK:
+      if (!inRange(a) || !inRange(b) || !inRange(c)) return false;
+      instance->setAckPulse(a, b, c);
+      break;
+    case KEYWORD_LOAD:
+      if (!inRange(a) || !inRange(b)) return false;
+      instance->setLoad(a, b);
+      break;
+    case KEYWORD_RUN:
+      if (runProgram!=RUN_DONE || !inRange(a)) return false;
+      run(a ? a : 10);
+      break;
+    default:
+      return false;
+  }
+  StringFormatter::send(stream, F("<O>\n"));
+  return true;
+}
+
+const FSH * SimulatedDecoder::programName(byte program) {
+  switch (program) {
+    case RUN_READ_CV:       return F("READ_CV_PROG");
+    case RUN_VERIFY_BYTE:   return F("VERIFY_BYTE_PROG");
+    case RUN_READ_BIT:      return F("READ_BIT_PROG");
+    case RUN_VERIFY_BIT:    return F("VERIFY_BIT1_PROG");
+    case RUN_WRITE_BYTE:    return F("WRITE_BYTE_PROG");
+    case RUN_WRITE_BIT:     return F("WRITE_BIT_PROG");
+    case RUN_LOCO_ID:       return F("LOCO_ID_PROG");
+    case RUN_LONG_LOCO_ID:  return F("LONG_LOCO_ID_PROG");
+    default:                return F("SHORT_LOCO_ID_PROG");
+  }
+}
+
+void SimulatedDecoder::run(int count) {
+  runCount=count;
+  runProgram=RUN_READ_CV;
+  runDone=0;
+  runFailures=0;
+  runStart=millis();
+  startOperation();
+}
+
+// Starts the next operation of runProgram, with the callback value it should give
+void SimulatedDecoder::startOperation() {
+  const byte * cvs=instance->cvs;
+  switch (runProgram) {
+    case RUN_READ_CV:
+      runExpected=cvs[8-1];
+      DCC::readCV(8, runCallback);
+      break;
+    case RUN_VERIFY_BYTE:
+      runExpected=cvs[7-1];
+      DCC::verifyCVByte(7, cvs[7-1], runCallback);
+      break;
+    case RUN_READ_BIT:
+      runExpected=bitRead(cvs[29-1], 2);
+      DCC::readCVBit(29, 2, runCallback);
+      break;
+    case RUN_VERIFY_BIT:
+      runExpected=bitRead(cvs[29-1], 1);
+      DCC::verifyCVBit(29, 1, true, runCallback);
+      break;
+    case RUN_WRITE_BYTE:
+      runExpected=1;
+      DCC::writeCVByte(50, lowByte(runDone), runCallback);
+      break;
+    case RUN_WRITE_BIT:
+      runExpected=1;
+      DCC::writeCVBit(50, 0, runDone & 1, runCallback);
+      break;
+    case RUN_LOCO_ID:
+      runExpected= (cvs[29-1] & 0x20) ? ((cvs[17-1]-192)<<8) + cvs[18-1] : cvs[1-1] & 0x7F;
+      DCC::getLocoId(runCallback);
+      break;
+    case RUN_LONG_LOCO_ID:
+      runExpected=1;
+      DCC::setLocoId(1000, runCallback);
+      break;
+    case RUN_SHORT_LOCO_ID:
+      runExpected=3;
+      DCC::setLocoId(3, runCallback);
+      break;
+  }
+}
+
+// Called by the ack manager from loop(), which picks up the next operation on its next pass
+void SimulatedDecoder::runCallback(int16_t result) {
+  if (result==-2) {  // prog track can't measure current, every operation would fail at once
+    StringFormatter::send(&Serial, F("SIMDECODER stopped, no current sense\n"));
+    runProgram=RUN_DONE;
+    return;
+  }
+  if (result!=runExpected) runFailures++;
+  if (++runDone>=runCount) {
+    unsigned long elapsed=millis()-runStart;
+    StringFormatter::send(&Serial, F("SIMDECODER %S %d %d %l\n"), programName(runProgram), runDone, runFailures,
+                          elapsed ? (long)(runDone*60000UL/elapsed) : 0L);
+    runDone=0;
+    runFailures=0;
+    runStart=millis();
+    if (++runProgram==RUN_DONE) return;
+  }
+  startOperation();
+}
+
+void SimulatedDecoder::setPower(bool on) {
+  MotorDriver::setPower(on);
+  powered=on;
+  if (!on) {
+    // decoder loses all state except its CVs
+    serviceMode=false;
+    ackActive=false;
+    lastLength=0;
+  }
+}
+
+// The waveform is a 1 bit as HIGH,LOW and a 0 bit as HIGH,HIGH,LOW,LOW
+// so the number of high halves before the first low gives the bit value.
+void SimulatedDecoder::setSignal(bool high) {
+  MotorDriver::setSignal(high);
+  if (high) {
+    highHalves++;
+    return;
+  }
+  if (highHalves) {
+    bit(highHalves==1);
+    highHalves=0;
+  }
+}
+
+// The decoder has to see every half bit
+bool SimulatedDecoder::canSetSignalFast() {
+  return false;
+}
+
+int SimulatedDecoder::getCurrentRaw(bool average) {
+  (void) average;
+  if (!powered) return 0;
+  int current=idleRaw;
+  if (ackActive) {
+    unsigned long elapsed=micros()-ackStart;
+    if (elapsed>=ackLatency) {
+      if (elapsed < (unsigned long)ackLatency+ackDuration) current+=ackRaw;
+      else ackActive=false;
+    }
+  }
+  if (noiseRaw>0) {
+    // xorshift is plenty random for a bit of wobble
+    noiseSeed ^= noiseSeed << 7;
+    noiseSeed ^= noiseSeed >> 9;
+    noiseSeed ^= noiseSeed << 8;
+    current += noiseSeed % (noiseRaw+1);
+  }
+  return current;
+}
+
+void SimulatedDecoder::bit(bool one) {
+  switch (decodeState) {
+    case PREAMBLE:
+      if (one) {
+        if (preambleCount<255) preambleCount++;
+        break;
+      }
+      if (preambleCount>=MIN_PREAMBLE) {  // packet start bit
+        decodeState=DATA;
+        packetLength=0;
+        bitCount=0;
+      }
+      preambleCount=0;
+      break;
+
+    case DATA:
+      currentByte=(currentByte<<1) | one;
+      if (++bitCount<8) break;
+      bitCount=0;
+      if (packetLength==MAX_PACKET) {  // too long, not for us
+        decodeState=PREAMBLE;
+        break;
+      }
+      packetBytes[packetLength++]=currentByte;
+      decodeState=SEPARATOR;
+      break;
+
+    case SEPARATOR:
+      if (one) {  // packet end bit, which is also a preamble bit
+        packet();
+        decodeState=PREAMBLE;
+        preambleCount=1;
+      }
+      else decodeState=DATA;
+      break;
+  }
+}
+
+void SimulatedDecoder::packet() {
+  byte checksum=0;
+  for (byte b=0;b<packetLength;b++) checksum^=packetBytes[b];
+  if (checksum!=0 || packetLength<3) return;
+
+  if (packetBytes[0]==0 && packetBytes[1]==0 && packetLength==3) {  // reset
+    serviceMode=true;
+    lastLength=0;
+    return;
+  }
+  if (!serviceMode || packetLength!=4 || (packetBytes[0] & 0xF0)!=0x70) {
+    // idle or operations mode packet
+    serviceMode=false;
+    lastLength=0;
+    return;
+  }
+
+  // Service mode instructions are only acted on when received twice in a row
+  if (lastLength==packetLength && memcmp(lastPacket,packetBytes,packetLength)==0) {
+    if (repeatCount<255) repeatCount++;
+  }
+  else {
+    memcpy(lastPacket,packetBytes,packetLength);
+    lastLength=packetLength;
+    repeatCount=1;
+  }
+  if (repeatCount!=2) return;
+
+  int cv=(((packetBytes[0] & 0x03)<<8) | packetBytes[1]) + 1;
+  if (cv>CV_COUNT) return;   // unsupported CV never ACKs
+  byte & value=cvs[cv-1];
+  byte data=packetBytes[2];
+
+  switch (packetBytes[0] & 0xFC) {
+    case 0x74:  // verify byte
+      if (value==data) ack();
+      break;
+    case 0x7C:  // write byte
+      value=data;
+      ack();
+      break;
+    case 0x78:  // bit manipulation 111KDBBB
+      {
+        byte mask=1<<(data & 0x07);
+        bool bitValue=(data & 0x08)!=0;
+        if ((data & 0xE0)!=0xE0) break;
+        if (data & 0x10) {  // write bit
+          if (bitValue) value|=mask;
+          else value&=~mask;
+          ack();
+        }
+        else if (((value & mask)!=0)==bitValue) ack();  // verify bit
+      }
+      break;
+  }
+}
+
+void SimulatedDecoder::ack() {
+  ackStart=micros();
+  ackActive=true;
+}
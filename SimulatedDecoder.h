@@ -0,0 +1,113 @@
+/*
+ *  © 2021, DCC-EX. All rights reserved.
+ *
+ *  This file is part of DCC-EX CommandStation-EX
+ *
+ *  This is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with CommandStation.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SimulatedDecoder_h
+#define SimulatedDecoder_h
+#include "MotorDriver.h"
+#include "DCCEXParser.h"
+
+// A prog track MotorDriver with a service mode decoder built in.
+// The real pins are still driven, but the half bits passed to setSignal()
+// are decoded into packets, verify and write packets are applied to an
+// in-memory CV image and any ACK is reported back as a current pulse from
+// getCurrentRaw(). This allows the ack manager programs to be exercised
+// and timed without a decoder on the track.
+//
+// Everything except the setters and command() runs in interrupt() time.
+//
+//    <D SIMDECODER CV cv value>                  set a CV in the image
+//    <D SIMDECODER ACK mA durationUs latencyUs>  shape of the ACK pulse
+//    <D SIMDECODER LOAD idlemA noisemA>          current when not ACKing
+//    <D SIMDECODER RUN [count]>                  run each ack manager program
+//                                                count times (default 10)
+// RUN prints a line to Serial for each program as it finishes
+//    SIMDECODER program runs failures perminute
+// where a failure is a callback value other than the one the CV image gives.
+// It writes CV 50, finishes with the decoder on short address 3, and needs
+// the prog track left alone until it is done.
+
+class SimulatedDecoder : public MotorDriver {
+  public:
+    SimulatedDecoder(byte power_pin, byte signal_pin, byte signal_pin2, int8_t brake_pin,
+                byte current_pin, float senseFactor, unsigned int tripMilliamps, byte faultPin);
+    virtual void setPower( bool on);
+    virtual void setSignal( bool high);
+    virtual bool canSetSignalFast();
+    virtual int  getCurrentRaw(bool average=false);
+
+    void setCV(int cv, byte value);
+    void setAckPulse(unsigned int mA, unsigned int durationUs, unsigned int latencyUs);
+    void setLoad(unsigned int idlemA, unsigned int noisemA);
+    static bool command(Print * stream, COMMAND_PARAM action, COMMAND_PARAM a, COMMAND_PARAM b, COMMAND_PARAM c);
+
+  private:
+    static SimulatedDecoder * instance;  // the last one made, there is only one prog track
+
+    // RUN, one ack manager operation at a time, the next started from the callback
+    enum RUN_PROGRAM : byte {
+      RUN_READ_CV, RUN_VERIFY_BYTE, RUN_READ_BIT, RUN_VERIFY_BIT, RUN_WRITE_BYTE,
+      RUN_WRITE_BIT, RUN_LOCO_ID, RUN_LONG_LOCO_ID, RUN_SHORT_LOCO_ID, RUN_DONE
+    };
+    static void run(int count);
+    static void startOperation();
+    static void runCallback(int16_t result);
+    static const FSH * programName(byte program);
+    static byte runProgram;
+    static int runCount;
+    static int runDone;
+    static int runFailures;
+    static int16_t runExpected;
+    static unsigned long runStart;
+
+    static const int CV_COUNT=256;       // CVs 1..CV_COUNT are simulated, others never ACK
+    static const byte MIN_PREAMBLE=10;
+    static const byte MAX_PACKET=6;      // including checksum
+
+    enum DECODE_STATE : byte {PREAMBLE, DATA, SEPARATOR};
+
+    void bit(bool one);
+    void packet();
+    void ack();
+
+    byte cvs[CV_COUNT];
+    bool powered;
+
+    // bit and packet decoding
+    DECODE_STATE decodeState;
+    byte highHalves;
+    byte preambleCount;
+    byte bitCount;
+    byte currentByte;
+    byte packetBytes[MAX_PACKET];
+    byte packetLength;
+    byte lastPacket[MAX_PACKET];
+    byte lastLength;
+    byte repeatCount;
+    bool serviceMode;   // resets seen since last idle or operations packet
+
+    // simulated current
+    volatile bool ackActive;
+    unsigned long ackStart;  // micros
+    unsigned int ackLatency; // micros
+    unsigned int ackDuration; // micros
+    int idleRaw;
+    int ackRaw;
+    int noiseRaw;
+    uint16_t noiseSeed;
+};
+#endif
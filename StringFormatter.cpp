@@ -28,6 +28,7 @@
 #endif
 
 #include "LCDDisplay.h"
+#include "Profiler.h"
 
 bool Diag::ACK=false;
 bool Diag::CMD=false;
@@ -64,13 +65,17 @@ void StringFormatter::lcd(byte row, const FSH* input...) {
 void StringFormatter::send(Print * stream, const FSH* input...) {
   va_list args;
   va_start(args, input);
+  PROFILE_MICROS_START(sendStart);
   send2(stream,input,args);
+  PROFILE_MICROS_END(sendStart, PROFILE_SEND);
 }
 
 void StringFormatter::send(Print & stream, const FSH* input...) {
   va_list args;
   va_start(args, input);
+  PROFILE_MICROS_START(sendStart);
   send2(&stream,input,args);
+  PROFILE_MICROS_END(sendStart, PROFILE_SEND);
 }
 
 void StringFormatter::send2(Print * stream,const FSH* format, va_list args) {
@@ -87,6 +87,7 @@ WiThrottle::WiThrottle( int wificlientid) {
 }
 
 WiThrottle::~WiThrottle() {
+  if (stashInstance==this) stashInstance=NULL;  // drive away callback must not find us
   if (firstThrottle== this) {
     firstThrottle=this->nextThrottle;
     return;
@@ -138,7 +139,7 @@ void WiThrottle::parse(RingStream * stream, byte * cmdx) {
               StringFormatter::send(stream,F("PPA%x\n"),DCCWaveform::mainTrack.getPowerMode()==POWERMODE::ON);
               lastPowerState = (DCCWaveform::mainTrack.getPowerMode()==POWERMODE::ON); //remember power state sent for comparison later
             }
-            else if (cmd[1]=='T' && cmd[2]=='A') { // PTA accessory toggle 
+            else if (cmd[1]=='T' && cmd[2]=='A' && cmd[3]) { // PTA accessory toggle 
                 int id=getInt(cmd+4); 
                 bool newstate=false;
                 Turnout * tt=Turnout::get(id);
@@ -186,7 +187,7 @@ void WiThrottle::parse(RingStream * stream, byte * cmdx) {
             }
             if (Diag::WITHROTTLE) DIAG(F("%l WiThrottle(%d) Quit"),millis(),clientid);
             delete this; 
-            break;           
+            return;  // nothing more of this throttle to parse
    }
    // skip over cmd until 0 or past \r or \n
    while(*cmd !='\0' && *cmd != '\r' && *cmd !='\n') cmd++;
@@ -209,11 +210,13 @@ int WiThrottle::getLocoId(byte * cmd) {
 }
 
 void WiThrottle::multithrottle(RingStream * stream, byte * cmd){ 
+          if (!cmd[1] || !cmd[2]) return;  // too short to be anything
           char throttleChar=cmd[1];
           int locoid=getLocoId(cmd+3); // -1 for *
           byte * aval=cmd;
           while(*aval !=';' && *aval !='\0') aval++;
-          if (*aval) aval+=2;  // skip ;>
+          if (*aval) aval++;  // skip ;
+          if (*aval) aval++;  // skip >
 
 //       DIAG(F("Multithrottle aval=%c cab=%d"), aval[0],locoid);    
        switch(cmd[2]) {
@@ -286,6 +289,7 @@ void WiThrottle::locoAction(RingStream * stream, byte* aval, char throttleChar,
            case 'F': //F onOff function
               {
 		            bool funcstate;
+                if (!aval[1]) break;
                 bool pressed=aval[1]=='1';
                 int fKey = getInt(aval+2);
                 LOOPLOCOS(throttleChar, cab) {
@@ -389,6 +393,7 @@ byte         WiThrottle::stashClient;
 char         WiThrottle::stashThrottleChar;
 
 void WiThrottle::getLocoCallback(int16_t locoid) {
+  if (!stashInstance) return;  // client went away while the loco was read
   stashStream->mark(stashClient);
   if (locoid<0) StringFormatter::send(stashStream,F("HMNo loco found on prog track\n"));
   else {
@@ -22,6 +22,8 @@
 #include "WifiInboundHandler.h"
 #include "RingStream.h"
 #include "CommandDistributor.h"
+#include "CommandRecorder.h"
+#include "CurrentMeters.h"
 #include "DIAG.h"
 
 WifiInboundHandler * WifiInboundHandler::singleton;
@@ -41,6 +43,7 @@ WifiInboundHandler::WifiInboundHandler(Stream * ESStream) {
   inboundRing=new RingStream(INBOUND_RING);
   outboundRing=new RingStream(OUTBOUND_RING);
   pendingCipsend=false;
+  for (byte link=0;link<MAX_LINK_ID;link++) framers[link]=NULL;
 } 
 
 
@@ -71,23 +74,31 @@ void WifiInboundHandler::loop1() {
       }
     
     
-    // if something waiting to execute, we can call it 
+    // if something waiting to execute, we can call it, and the next one
+    // until the command budget is spent or the replies may not fit
+    unsigned long startTime=micros();
+    while (micros()-startTime < COMMAND_BUDGET_MICROS && outboundRing->freeSpace() >= MIN_REPLY_SPACE) {
       int clientId=inboundRing->read();
-      if (clientId>=0) {
-         int count=inboundRing->count();
-         if (Diag::WIFI) DIAG(F("Wifi EXEC: %d %d:"),clientId,count); 
-         byte cmd[count+1];
-         for (int i=0;i<count;i++) cmd[i]=inboundRing->read();   
-         cmd[count]=0;
-         if (Diag::WIFI) DIAG(F("%e"),cmd); 
-         
-         outboundRing->mark(clientId);  // remember start of outbound data 
-         CommandDistributor::parse(clientId,cmd,outboundRing);
-         // The commit call will either write the lenbgth bytes 
-         // OR rollback to the mark because the reply is empty or commend generated more than fits the buffer 
-         outboundRing->commit();
-         return;
+      if (clientId<0) return;
+      int count=inboundRing->count();
+      if (clientId==RingStream::PADDING_MARK) {
+        inboundRing->skip(count);
+        continue;
       }
+      if (Diag::WIFI) DIAG(F("Wifi EXEC: %d %d:"),clientId,count); 
+      // The command was stored in one piece with its terminator, parse it where it is
+      byte * cmd=inboundRing->peekContiguous(count);
+      if (cmd) {
+        if (Diag::WIFI) DIAG(F("%e"),cmd); 
+        RECORD_COMMAND(RECORD_WIFI+clientId, cmd, count-1);
+        outboundRing->mark(clientId);  // remember start of outbound data 
+        CommandDistributor::parse(clientId,cmd,count-1,outboundRing);  // without the terminator
+        // The commit call will either write the lenbgth bytes 
+        // OR rollback to the mark because the reply is empty or commend generated more than fits the buffer 
+        outboundRing->commit();
+      }
+      inboundRing->skip(count);
+    }
    }
 
 
@@ -175,7 +186,7 @@ WifiInboundHandler::INBOUND_STATE WifiInboundHandler::loop2() {
         break;
         
       case IPD4_CLIENT:  // reading connection id
-        if (ch >= '0' || ch <='9'){
+        if (ch >= '0' && ch <='9'){
            runningClientId=ch-'0';
            loopState=IPD5;
         }
@@ -194,29 +205,32 @@ WifiInboundHandler::INBOUND_STATE WifiInboundHandler::loop2() {
             break;
           }
           if (Diag::WIFI) DIAG(F("Wifi inbound data(%d:%d):"),runningClientId,dataLength); 
-          if (inboundRing->freeSpace()<=(dataLength+1)) {
-            // This input would overflow the inbound ring, ignore it  
-            loopState=IPD_IGNORE_DATA;
-            if (Diag::WIFI) DIAG(F("Wifi OVERFLOW IGNORING:"));    
-            break;
-          }
-          inboundRing->mark(runningClientId);
+          if (!framers[runningClientId]) framers[runningClientId]=new CommandFramer();
           loopState=IPD_DATA;
           break; 
         }
+        if (ch<'0' || ch>'9' || dataLength>999) {
+          // garbled length, counting it down could swallow everything that follows 
+          loopState=SKIPTOEND;
+          break;
+        }
         dataLength = dataLength * 10 + (ch - '0');
         break;
         
       case IPD_DATA: // reading data
-        inboundRing->write(ch);    
-        dataLength--;
-        if (dataLength == 0) {
-          inboundRing->commit();    
-          loopState = ANYTHING;
+        {
+          // A command may be split over several +IPD or several commands may
+          // arrive in one, so the link's framer decides where each one ends.
+          CommandFramer * framer=framers[runningClientId];
+          int length=framer->add(ch);
+          if (length==CommandFramer::TOO_LONG) {
+            // answered straight away, ahead of any commands from this link still queued
+            outboundRing->mark(runningClientId);
+            framer->reject(outboundRing);
+            outboundRing->commit();
+          }
+          else if (length) storeCommand(framer, length);
         }
-        break;
-
-      case IPD_IGNORE_DATA: // ignoring data that would not fit in inbound ring
         dataLength--;
         if (dataLength == 0) loopState = ANYTHING;
         break;
@@ -229,6 +243,9 @@ WifiInboundHandler::INBOUND_STATE WifiInboundHandler::loop2() {
         if (ch=='C') {
          // got "x C" before CLOSE or CONNECTED, or CONNECT FAILED
          if (runningClientId==clientPendingCIPSEND) purgeCurrentCIPSEND();
+         // any partial command or meter subscription belonged to the previous connection on this link
+         if (framers[runningClientId]) framers[runningClientId]->reset();
+         CurrentMeters::unsubscribe(outboundRing, runningClientId);
         }
         loopState=SKIPTOEND;   
         break;
@@ -241,6 +258,19 @@ WifiInboundHandler::INBOUND_STATE WifiInboundHandler::loop2() {
   return (loopState==ANYTHING) ? INBOUND_IDLE: INBOUND_BUSY;
 }
 
+// Queue a complete command in one piece with a terminator so it can be parsed in place
+void WifiInboundHandler::storeCommand(CommandFramer * framer, int length) {
+  if (!inboundRing->markContiguous(runningClientId, length+1)) {
+    // This command would overflow the inbound ring, ignore it
+    if (Diag::WIFI) DIAG(F("Wifi OVERFLOW IGNORING:"));
+    return;
+  }
+  byte * command=framer->frame();
+  for (int i=0;i<length;i++) inboundRing->write(command[i]);
+  inboundRing->write((uint8_t)0);
+  inboundRing->commit();
+}
+
 void WifiInboundHandler::purgeCurrentCIPSEND() {
          // A CIPSEND was sent but errored... or the client closed just toss it away
          if (Diag::WIFI) DIAG(F("Wifi: DROPPING CIPSEND=%d,%d"),clientPendingCIPSEND,currentReplySize);
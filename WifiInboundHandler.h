@@ -22,6 +22,7 @@
 
 #include "RingStream.h"
 #include "WiThrottle.h"
+#include "CommandFramer.h"
 #include "DIAG.h"
 
 class WifiInboundHandler {
@@ -52,7 +53,6 @@ class WifiInboundHandler {
           IPD5,        // got +IPD,c 
           IPD6_LENGTH, // got +IPD,c, reading length 
           IPD_DATA,    // got +IPD,c,ll,: collecting data
-          IPD_IGNORE_DATA, // got +IPD,c,ll,: ignoring the data that won't fit inblound Ring
 
           GOT_CLIENT_ID,  // clientid prefix to CONNECTED / CLOSED
           GOT_CLIENT_ID2  // clientid prefix to CONNECTED / CLOSED
@@ -63,13 +63,17 @@ class WifiInboundHandler {
    void loop1();
    INBOUND_STATE loop2();
    void purgeCurrentCIPSEND();
+   void storeCommand(CommandFramer * framer, int length);
    Stream * wifiStream;
    
    static const int INBOUND_RING = 512;
    static const int OUTBOUND_RING = 2048;
+   static const int MIN_REPLY_SPACE = 512;  // outbound space needed to run another command
+   static const byte MAX_LINK_ID = 10;      // ESP link ids are a single digit
  
    RingStream * inboundRing;
    RingStream * outboundRing;
+   CommandFramer * framers[MAX_LINK_ID];   // partial command of each link, created on first data
      
   LOOP_STATE loopState=ANYTHING;
   int runningClientId;   // latest client inbound processing data or CLOSE
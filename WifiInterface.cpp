@@ -25,6 +25,7 @@
 #include "StringFormatter.h"
 
 #include "WifiInboundHandler.h"
+#include "DCCWaveform.h"
 
 
 
@@ -100,7 +101,7 @@ bool WifiInterface::setup(long serial_link_speed,
   if (wifiUp == WIFI_NOAT) // here and still not AT commands found
       return false;
 
-  DCCEXParser::setAtCommandCallback(ATCommand);
+  DCCEXParser::addCommands(commands);
   // CAUTION... ONLY CALL THIS ONCE 
   WifiInboundHandler::setup(wifiStream);
   if (wifiUp == WIFI_CONNECTED)
@@ -320,6 +321,21 @@ wifiSerialState WifiInterface::setup2(const FSH* SSid, const FSH* password,
 // to force on the connectd flag so that the loop will start picking up wifi traffic.
 // If the settings are corrupted <+RST> will clear this and then you must restart the arduino.
  
+const COMMAND_ENTRY WifiInterface::commands[] FLASH = {
+  {'+', 0, DCCEXParser::TEXT_PARAMS, parseAT},  // Complex Wifi interface command <+ATCOMMAND>
+  {'\0', 0, 0, NULL}
+};
+
+bool WifiInterface::parseAT(Print * stream, byte opcode, byte params, COMMAND_PARAM p[], byte * com, RingStream * ringStream) {
+  (void)stream; (void)opcode; (void)params; (void)p; (void)ringStream;
+  if (!com) return false;  // binary frames can't carry AT commands
+  DCCWaveform::mainTrack.setPowerMode(POWERMODE::OFF);
+  DCCWaveform::progTrack.setPowerMode(POWERMODE::OFF);
+  DCCWaveform::setDistrictsPowerMode(POWERMODE::OFF);
+  ATCommand(com);
+  return true;
+}
+
 void WifiInterface::ATCommand(const byte * command) {
   command++;
   if (*command=='X') {
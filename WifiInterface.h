@@ -49,5 +49,7 @@ private:
   static bool checkForOK(const unsigned int timeout, bool echo, bool escapeEcho = true);
   static bool checkForOK(const unsigned int timeout, const FSH *waitfor, bool echo, bool escapeEcho = true);
   static bool connected;
+  static bool parseAT(Print * stream, byte opcode, byte params, COMMAND_PARAM p[], byte * com, RingStream * ringStream);
+  static const COMMAND_ENTRY commands[];
 };
 #endif
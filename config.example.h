@@ -38,10 +38,20 @@ The configuration file for DCC-EX Command Station
 //  FIREBOX_MK1           : The Firebox MK1                    
 //  FIREBOX_MK1S          : The Firebox MK1S
 //  IBT_2_WITH_ARDUINO    : Arduino Motor Shield for PROG and IBT-2 for MAIN
+//  SIMULATED_DECODER_SHIELD : Arduino Motor Shield with a simulated decoder on PROG (testing only)
+//                             set up and timed with <D SIMDECODER ...>, see SimulatedDecoder.h
 //   |
 //   +-----------------------v
 //
 #define MOTOR_SHIELD_TYPE STANDARD_MOTOR_SHIELD
+//
+// Larger layouts can be split into extra power districts (up to 4). Each district
+// has its own motor driver carrying the main track signal, with its own power
+// state and overload protection, and is switched with <1 n> and <0 n>.
+// <1>, <0>, <1 MAIN> and <0 MAIN> switch all the districts along with the main track.
+// Use the same parameters as the MotorDriver entries in MotorDrivers.h, for example
+//
+// #define DISTRICT_DRIVERS new MotorDriver(5, 6, UNUSED_PIN, UNUSED_PIN, A2, 2.99, 2000, UNUSED_PIN), new MotorDriver(7, 8, UNUSED_PIN, UNUSED_PIN, A3, 2.99, 2000, UNUSED_PIN)
 /////////////////////////////////////////////////////////////////////////////////////
 //
 // The IP port to talk to a WIFI or Ethernet shield.
@@ -128,3 +138,53 @@ The configuration file for DCC-EX Command Station
 
 /////////////////////////////////////////////////////////////////////////////////////
 
+//
+// COMMAND BUDGET
+//
+// Serial, WiFi and Ethernet each keep executing waiting commands until they
+// have used this many microseconds of a loop(), so a burst of definitions
+// from JMRI is not spread over one loop() per command. Lower it if the
+// display or sensors get sluggish during bursts.
+// #define COMMAND_BUDGET_MICROS 2000
+
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// COMMAND LIMITS
+//
+// A command longer than COMMAND_BUFFER_SIZE characters or with more than
+// COMMAND_MAX_PARAMS parameters is answered with <X> and a diagnostic saying
+// why. The defaults are 50 and 10 on Uno/Nano/Mega and 128 and 16 elsewhere.
+// COMMAND_BUFFER_SIZE can be at most 255.
+// #define COMMAND_BUFFER_SIZE 50
+// #define COMMAND_MAX_PARAMS 10
+//
+// Parameters are 16 bit unless COMMAND_PARAMS_32BIT is defined, in which
+// case a value too big for 16 bits is accepted instead of rejected. This
+// costs 2 bytes of RAM per parameter and a little parsing time, and any
+// filter set with DCCEXParser::setFilter sees int32_t parameters.
+// #define COMMAND_PARAMS_32BIT
+
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// PROFILER
+//
+// ENABLE_PROFILER: Time the DCC interrupt, ack checking, command parsing and
+// reply formatting in CPU cycles. <D PROFILE> prints count, min, avg and max
+// for each point, plus command to rail latency percentiles in uS, and
+// <D PROFILE RESET> clears them. AVR boards only, and
+// it adds a little time to every interrupt so leave it off normally.
+// #define ENABLE_PROFILER
+
+/////////////////////////////////////////////////////////////////////////////////////
+//
+// COMMAND RECORDER
+//
+// ENABLE_RECORDER: Keep the commands from serial, WiFi and Ethernet with their
+// timing in RECORDER_SIZE bytes of RAM, so a session from the layout can be
+// played back as repeatable load. <D RECORD ON> starts recording,
+// <D RECORD OFF> stops, <D RECORD DUMP> prints the recording in hex and
+// <D RECORD PLAY> or <D RECORD PLAY FAST> plays it back.
+// #define ENABLE_RECORDER
+// #define RECORDER_SIZE 1024
+
+/////////////////////////////////////////////////////////////////////////////////////